@@ -1,4 +1,21 @@
 LOCAL_PATH := $(call my-dir)
+
+# Uncomment to also serve fixes to local gpsd clients
+#VOGUE_GPSD_SOCKET := /dev/socket/gpsd
+
+# vogue_track.c on its own, so the flags its coordinate and speed passes
+# need to vectorize don't apply to the rest of the HAL
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libvogue_track
+
+LOCAL_SRC_FILES += \
+    vogue_track.c
+
+LOCAL_CFLAGS += -O3 -fno-math-errno
+
+include $(BUILD_STATIC_LIBRARY)
+
 include $(CLEAR_VARS)
 
 LOCAL_MODULE := libgps
@@ -6,4 +23,57 @@ LOCAL_MODULE := libgps
 LOCAL_SRC_FILES += \
     vogue_gps.c
 
+LOCAL_STATIC_LIBRARIES := libvogue_track
+
+# Build-time options; see vogue_config.h for the full list
+#LOCAL_CFLAGS += -DVOGUE_GPS_DEBUG=0
+#LOCAL_CFLAGS += -DVOGUE_GPS_SMOOTHING=1
+
+ifneq ($(VOGUE_GPSD_SOCKET),)
+LOCAL_SRC_FILES += vogue_gpsd.c
+LOCAL_CFLAGS += -DVOGUE_GPSD_SOCKET=\"$(VOGUE_GPSD_SOCKET)\"
+endif
+
 include $(BUILD_SHARED_LIBRARY)
+
+# Offline trace processing, for use on recorded fixes off the device
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gpstrack
+
+LOCAL_SRC_FILES += \
+    gpstrack.c \
+    vogue_track.c
+
+# The coordinate and speed passes in vogue_track.c only vectorize with
+# the vectorizer on and sqrt() free of errno
+LOCAL_CFLAGS += -O3 -fno-math-errno
+LOCAL_LDLIBS += -lpthread -lm
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Session lifecycle benchmark; runs against the real device
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gpscycle
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES += \
+    gpscycle.c \
+    vogue_gps.c
+
+LOCAL_STATIC_LIBRARIES := libvogue_track
+
+include $(BUILD_EXECUTABLE)
+
+# gpsd server load test; needs no GPS hardware
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gpsdload
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES += \
+    gpsdload.c \
+    vogue_gpsd.c
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,224 @@
+/* gpscycle: exercise the HAL session lifecycle.
+ *
+ * Runs a number of start/stop cycles on one session, then a number of
+ * full init/start/stop/cleanup cycles, and reports any file descriptors
+ * or threads left behind.
+ *
+ * Every session runs until its first fix, so the GPS thread is sitting
+ * in select() when stop comes.  On one session, where the thread is
+ * reused, stop latency runs from stop to the GPS thread reporting
+ * GPS_STATUS_SESSION_END on its way back to waiting for the next start.
+ * For full sessions it runs from stop to the end of cleanup, which joins
+ * the thread.  At the default fix interval, a stop that was only noticed
+ * on the select() timeout would show up as close to a minute either way.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include "gps.h"
+
+static pthread_mutex_t cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cb_wq = PTHREAD_COND_INITIALIZER;
+static int nfixes, nsession_ends;
+
+static void count (int *counter)
+{
+    pthread_mutex_lock(&cb_mutex);
+    (*counter)++;
+    pthread_cond_broadcast(&cb_wq);
+    pthread_mutex_unlock(&cb_mutex);
+}
+
+static int counted (int *counter)
+{
+    int n;
+
+    pthread_mutex_lock(&cb_mutex);
+    n = *counter;
+    pthread_mutex_unlock(&cb_mutex);
+    return n;
+}
+
+static void location_cb (GpsLocation *location)
+{
+    (void)location;
+    count(&nfixes);
+}
+
+static void status_cb (GpsStatus *status)
+{
+    if (status->status == GPS_STATUS_SESSION_END)
+        count(&nsession_ends);
+}
+
+static void sv_status_cb (GpsSvStatus *sv_info) { (void)sv_info; }
+
+static GpsCallbacks callbacks = {
+    .location_cb    = location_cb,
+    .status_cb      = status_cb,
+    .sv_status_cb   = sv_status_cb,
+};
+
+static int count_entries (const char *path)
+{
+    DIR *dir;
+    struct dirent *de;
+    int n = 0;
+
+    dir = opendir(path);
+    if (!dir)
+        return -1;
+    while ((de = readdir(dir)))
+        if (de->d_name[0] != '.')
+            n++;
+    closedir(dir);
+    return n;
+}
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Waits up to 5s for a callback to bump *counter past seen; returns 0 if
+ * it did */
+static int wait_for (int *counter, int seen)
+{
+    struct timespec ts;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 5;
+    pthread_mutex_lock(&cb_mutex);
+    while (*counter == seen && rc == 0)
+        rc = pthread_cond_timedwait(&cb_wq, &cb_mutex, &ts);
+    rc = *counter == seen ? -1 : 0;
+    pthread_mutex_unlock(&cb_mutex);
+    return rc;
+}
+
+/* Starts a session and waits for its first fix */
+static int start_session (const GpsInterface *gps)
+{
+    int seen = counted(&nfixes);
+
+    return gps->start() || wait_for(&nfixes, seen);
+}
+
+/* Stops the session; with wait_idle, also waits for the GPS thread to
+ * report the session over */
+static int stop_session (const GpsInterface *gps, int wait_idle)
+{
+    int seen = counted(&nsession_ends);
+
+    gps->stop();
+    return wait_idle ? wait_for(&nsession_ends, seen) : 0;
+}
+
+static int cmp_double (const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report (const char *what, double *lat, int n)
+{
+    double total = 0;
+    int i;
+
+    for (i=0; i<n; i++)
+        total += lat[i];
+    qsort(lat, n, sizeof(*lat), cmp_double);
+    printf("%-14s %6d cycles  avg %8.1f us  p50 %8.1f us  p99 %8.1f us  "
+           "max %8.1f us\n", what, n, total / n * 1e6, lat[n / 2] * 1e6,
+           lat[n * 99 / 100] * 1e6, lat[n - 1] * 1e6);
+}
+
+int main (int argc, char **argv)
+{
+    const GpsInterface *gps = gps_get_hardware_interface();
+    int cycles = 1000;
+    int fds, threads, rc, i;
+    double *lat, *stoplat, start, stop;
+
+    if (argc > 1)
+        cycles = atoi(argv[1]);
+    if (cycles <= 0) {
+        fprintf(stderr, "usage: gpscycle [cycles]\n");
+        return 1;
+    }
+    lat = malloc(cycles * sizeof(*lat));
+    stoplat = malloc(cycles * sizeof(*stoplat));
+    if (!lat || !stoplat) {
+        perror("malloc");
+        return 1;
+    }
+
+    /* Only the simulated device looks at this.  Sessions wait for their
+     * first fix, and the thread still spends nearly all its time in
+     * select() between fixes. */
+    setenv("VOGUE_SIM_PERIOD_MS", "1", 0);
+
+    fds = count_entries("/proc/self/fd");
+    threads = count_entries("/proc/self/task");
+
+    rc = gps->init(&callbacks);
+    if (rc) {
+        fprintf(stderr, "init failed: %d\n", rc);
+        return 1;
+    }
+    for (i=0; i<cycles; i++) {
+        if (start_session(gps)) {
+            fprintf(stderr, "no fix after start on cycle %d\n", i);
+            return 1;
+        }
+        stop = now();
+        if (stop_session(gps, 1)) {
+            fprintf(stderr, "thread still busy after stop on cycle %d\n", i);
+            return 1;
+        }
+        stoplat[i] = now() - stop;
+    }
+    gps->cleanup();
+    report("stop to idle", stoplat, cycles);
+
+    for (i=0; i<cycles; i++) {
+        start = now();
+        if (gps->init(&callbacks)) {
+            fprintf(stderr, "init failed on cycle %d\n", i);
+            return 1;
+        }
+        lat[i] = now() - start;
+
+        if (start_session(gps)) {
+            fprintf(stderr, "no fix after start on cycle %d\n", i);
+            return 1;
+        }
+
+        stop = now();
+        stop_session(gps, 0);
+        gps->cleanup();
+        stoplat[i] = now() - stop;
+        lat[i] += stoplat[i];
+    }
+    report("stop+cleanup", stoplat, cycles);
+    report("init+cleanup", lat, cycles);
+
+    /* cleanup must be safe to repeat */
+    gps->cleanup();
+
+    fds = count_entries("/proc/self/fd") - fds;
+    threads = count_entries("/proc/self/task") - threads;
+    printf("leaked: %d fds, %d threads\n", fds, threads);
+
+    free(lat);
+    free(stoplat);
+    return fds || threads;
+}
@@ -0,0 +1,196 @@
+/* gpsdload: load test for the gpsd JSON server.
+ *
+ * Starts the server in-process, connects a number of watching clients
+ * (1000 by default) and publishes TPV/SKY pairs one at a time, waiting
+ * for every client to receive each pair before sending the next.  Reports
+ * how long the fan-out took and whether any client missed a report.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "gps.h"
+#include "vogue_gpsd.h"
+
+/* VERSION on connect, then DEVICES and WATCH in reply to ?WATCH */
+#define HANDSHAKE_LINES 3
+
+struct load_client {
+    int fd;
+    long lines;
+};
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double (const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Reads whatever is available from every ready client until the total
+ * line count reaches target or timeout_ms passes without progress */
+static long pump (int epfd, long total, long target, int timeout_ms)
+{
+    struct epoll_event events[256];
+    char buf[4096];
+    int i, n;
+
+    while (total < target) {
+        n = epoll_wait(epfd, events, 256, timeout_ms);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (i=0; i<n; i++) {
+            struct load_client *c = events[i].data.ptr;
+            ssize_t len;
+            char *p;
+
+            while ((len = read(c->fd, buf, sizeof(buf))) > 0) {
+                for (p = buf; (p = memchr(p, '\n', buf + len - p)); p++) {
+                    c->lines++;
+                    total++;
+                }
+            }
+        }
+    }
+    return total;
+}
+
+int main (int argc, char **argv)
+{
+    const char *path = "/tmp/gpsdload.sock";
+    struct load_client *clients;
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    struct rlimit rl;
+    GpsLocation location;
+    GpsSvStatus sv_info;
+    int nclients = 1000, rounds = 200;
+    long total = 0, missed;
+    double *lat, start, begin;
+    int epfd, i, rc;
+
+    if (argc > 1)
+        nclients = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+    if (nclients <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: gpsdload [clients] [rounds]\n");
+        return 1;
+    }
+
+    /* Both ends of every connection live in this process */
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)nclients * 2 + 64) {
+        rl.rlim_cur = (rlim_t)nclients * 2 + 64;
+        if (rl.rlim_cur > rl.rlim_max)
+            rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    rc = vogue_gpsd_start(path, "/dev/vogue_gps", 0);
+    if (rc) {
+        fprintf(stderr, "server failed to start: %d\n", rc);
+        return 1;
+    }
+
+    clients = calloc(nclients, sizeof(*clients));
+    lat = malloc(rounds * sizeof(*lat));
+    epfd = epoll_create(nclients);
+    if (!clients || !lat || epfd < 0) {
+        perror("setup");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    begin = now();
+    for (i=0; i<nclients; i++) {
+        static const char watch[] = "?WATCH={\"enable\":true,\"json\":true};";
+
+        clients[i].fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (clients[i].fd < 0 ||
+            connect(clients[i].fd, (struct sockaddr *)&addr,
+                    sizeof(addr)) < 0) {
+            fprintf(stderr, "client %d: %s\n", i, strerror(errno));
+            return 1;
+        }
+        if (write(clients[i].fd, watch, sizeof(watch) - 1) < 0) {
+            perror("write");
+            return 1;
+        }
+        fcntl(clients[i].fd, F_SETFL, O_NONBLOCK);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &clients[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+
+        /* Drain as we go so the listen backlog never fills */
+        total = pump(epfd, total, 0, 0);
+    }
+    total = pump(epfd, total, (long)nclients * HANDSHAKE_LINES, 5000);
+    printf("%d clients connected and watching in %.1f ms\n", nclients,
+           (now() - begin) * 1e3);
+
+    memset(&location, 0, sizeof(location));
+    location.flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY |
+        GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING;
+    location.latitude = 37.0;
+    location.longitude = -122.0;
+    location.accuracy = 3.0;
+    memset(&sv_info, 0, sizeof(sv_info));
+    sv_info.num_svs = 8;
+    for (i=0; i<sv_info.num_svs; i++) {
+        sv_info.sv_list[i].prn = i + 1;
+        sv_info.sv_list[i].snr = 30 + i;
+    }
+
+    begin = now();
+    for (i=0; i<rounds; i++) {
+        long target = (long)nclients * (HANDSHAKE_LINES + 2 * (i + 1));
+
+        location.latitude += 0.0001;
+        location.timestamp = i;
+        start = now();
+        vogue_gpsd_send_sv_status(&sv_info);
+        vogue_gpsd_send_location(&location);
+        total = pump(epfd, total, target, 1000);
+        lat[i] = now() - start;
+    }
+    printf("%d rounds in %.1f ms, %.0f reports/s delivered\n", rounds,
+           (now() - begin) * 1e3,
+           (total - (double)nclients * HANDSHAKE_LINES) / (now() - begin));
+
+    qsort(lat, rounds, sizeof(*lat), cmp_double);
+    printf("fan-out to all clients: p50 %.1f us  p99 %.1f us  max %.1f us\n",
+           lat[rounds / 2] * 1e6, lat[rounds * 99 / 100] * 1e6,
+           lat[rounds - 1] * 1e6);
+
+    missed = 0;
+    for (i=0; i<nclients; i++)
+        missed += HANDSHAKE_LINES + 2 * rounds - clients[i].lines;
+    printf("missed reports: %ld\n", missed);
+
+    for (i=0; i<nclients; i++)
+        close(clients[i].fd);
+    vogue_gpsd_stop();
+    free(clients);
+    free(lat);
+    return missed != 0;
+}
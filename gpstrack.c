@@ -0,0 +1,309 @@
+/* gpstrack: offline post-processing of recorded vogue GPS traces.
+ *
+ * Input is either text, one "time lat lng" line per fix with the raw
+ * kernel values, or (-r) a raw dump of struct gps_state records as read
+ * from /dev/vogue_gps.  Output is one CSV line per new fix:
+ *
+ *     time,latitude,longitude,speed,bearing,flags
+ *
+ * -b runs the batch API against the HAL's one-fix-at-a-time path on the
+ * same input and reports the time each took instead.  -t checks that the
+ * batch API, single and multi-threaded, reports exactly what the
+ * one-fix-at-a-time path does.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "gps.h"
+#include "vogue_gps.h"
+#include "vogue_track.h"
+
+struct trace {
+    int32_t *lat;
+    int32_t *lng;
+    uint32_t *time;
+    size_t n, alloc;
+};
+
+static int trace_add (struct trace *t, uint32_t time, int32_t lat, int32_t lng)
+{
+    if (t->n == t->alloc) {
+        size_t alloc = t->alloc ? t->alloc * 2 : 4096;
+        int32_t *nlat, *nlng;
+        uint32_t *ntime;
+
+        nlat = realloc(t->lat, alloc * sizeof(*nlat));
+        if (nlat)
+            t->lat = nlat;
+        nlng = realloc(t->lng, alloc * sizeof(*nlng));
+        if (nlng)
+            t->lng = nlng;
+        ntime = realloc(t->time, alloc * sizeof(*ntime));
+        if (ntime)
+            t->time = ntime;
+        if (!nlat || !nlng || !ntime)
+            return -1;
+        t->alloc = alloc;
+    }
+    t->lat[t->n] = lat;
+    t->lng[t->n] = lng;
+    t->time[t->n] = time;
+    t->n++;
+    return 0;
+}
+
+static int read_text (FILE *f, struct trace *t)
+{
+    char line[256];
+    unsigned long time;
+    long lat, lng;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%lu %ld %ld", &time, &lat, &lng) != 3) {
+            fprintf(stderr, "bad line: %s", line);
+            return -1;
+        }
+        if (trace_add(t, time, lat, lng))
+            return -1;
+    }
+    return 0;
+}
+
+static int read_raw (FILE *f, struct trace *t)
+{
+    struct gps_state data;
+
+    while (fread(&data, sizeof(data), 1, f) == 1) {
+        if (trace_add(t, data.time, data.lat, data.lng))
+            return -1;
+    }
+    return 0;
+}
+
+/* What send_position_data does for each fix, minus the callback */
+static size_t process_scalar (const struct trace *t, double correction_factor,
+                              GpsLocation *locations)
+{
+    uint32_t last_fix = 0;
+    double last_lat = 0, last_lon = 0;
+    size_t i, nfix = 0;
+
+    for (i=0; i<t->n; i++) {
+        GpsLocation *location = &locations[nfix];
+
+        if (i && t->time[i] == last_fix)
+            continue;
+
+        memset(location, 0, sizeof(*location));
+        location->flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY;
+        location->latitude = vogue_track_coord(t->lat[i], correction_factor);
+        location->longitude = vogue_track_coord(t->lng[i], correction_factor);
+        if (last_lat && last_lon) {
+            location->speed = vogue_track_speed(
+                vogue_track_delta(location->latitude - last_lat,
+                                  location->longitude - last_lon),
+                t->time[i] - last_fix);
+            location->bearing = vogue_track_bearing(
+                location->latitude - last_lat,
+                location->longitude - last_lon);
+            location->flags |= GPS_LOCATION_HAS_SPEED;
+            location->flags |= GPS_LOCATION_HAS_BEARING;
+        }
+        last_fix = t->time[i];
+        last_lat = location->latitude;
+        last_lon = location->longitude;
+        location->accuracy = 3.0;
+        location->timestamp = t->time[i];
+        nfix++;
+    }
+    return nfix;
+}
+
+/* Returns the number of fixes that differ */
+static size_t check (const struct trace *t, struct vogue_track_in *in,
+                     struct vogue_track_out *out, double correction_factor,
+                     int nthreads)
+{
+    GpsLocation *locations;
+    size_t i, k, nfix, bad = 0;
+
+    locations = malloc(t->n * sizeof(*locations));
+    if (!locations) {
+        perror("malloc");
+        return t->n;
+    }
+    nfix = process_scalar(t, correction_factor, locations);
+
+    vogue_track_process_mt(in, out, t->n, correction_factor, nthreads);
+    for (i=0, k=0; i<t->n; i++) {
+        if (!out->flags[i])
+            continue;
+        if (k >= nfix ||
+            out->latitude[i] != locations[k].latitude ||
+            out->longitude[i] != locations[k].longitude ||
+            out->speed[i] != locations[k].speed ||
+            out->bearing[i] != locations[k].bearing ||
+            out->flags[i] != locations[k].flags) {
+            if (bad++ < 10)
+                fprintf(stderr, "entry %zu (time %u) differs\n", i,
+                        t->time[i]);
+        }
+        k++;
+    }
+    if (k != nfix) {
+        fprintf(stderr, "batch reported %zu fixes, expected %zu\n", k, nfix);
+        bad += k > nfix ? k - nfix : nfix - k;
+    }
+
+    free(locations);
+    return bad;
+}
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char *what, size_t n, int reps, double elapsed)
+{
+    printf("%-10s %10.2f ns/fix %12.0f fixes/s\n", what,
+           elapsed * 1e9 / ((double)n * reps), (double)n * reps / elapsed);
+}
+
+static void benchmark (const struct trace *t, struct vogue_track_in *in,
+                       struct vogue_track_out *out, double correction_factor,
+                       int nthreads)
+{
+    GpsLocation *locations;
+    double start;
+    int i, reps;
+
+    locations = malloc(t->n * sizeof(*locations));
+    if (!locations) {
+        perror("malloc");
+        return;
+    }
+
+    /* Aim for a few hundred million fixes per variant */
+    reps = 200000000 / t->n;
+    if (reps < 1)
+        reps = 1;
+
+    printf("%zu fixes x %d\n", t->n, reps);
+
+    start = now();
+    for (i=0; i<reps; i++)
+        process_scalar(t, correction_factor, locations);
+    report("scalar", t->n, reps, now() - start);
+
+    start = now();
+    for (i=0; i<reps; i++)
+        vogue_track_process(in, out, t->n, correction_factor);
+    report("batch", t->n, reps, now() - start);
+
+    start = now();
+    for (i=0; i<reps; i++)
+        vogue_track_process_mt(in, out, t->n, correction_factor, nthreads);
+    report("batch-mt", t->n, reps, now() - start);
+
+    free(locations);
+}
+
+static void usage (void)
+{
+    fprintf(stderr, "usage: gpstrack [-r] [-b|-t] [-c correction] "
+            "[-j threads] [file]\n");
+    exit(1);
+}
+
+int main (int argc, char **argv)
+{
+    struct trace t = { 0 };
+    struct vogue_track_in in;
+    struct vogue_track_out out;
+    double correction_factor = 1.0;
+    int raw = 0, bench = 0, test = 0, nthreads = 0;
+    FILE *f = stdin;
+    size_t i;
+    int c, rc;
+
+    while ((c = getopt(argc, argv, "rbtc:j:")) != -1) {
+        switch (c) {
+        case 'r':
+            raw = 1;
+            break;
+        case 'b':
+            bench = 1;
+            break;
+        case 't':
+            test = 1;
+            break;
+        case 'c':
+            correction_factor = atof(optarg);
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind < argc - 1 || correction_factor == 0)
+        usage();
+    if (optind < argc) {
+        f = fopen(argv[optind], "rb");
+        if (!f) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+
+    rc = raw ? read_raw(f, &t) : read_text(f, &t);
+    if (rc) {
+        fprintf(stderr, "failed to read trace\n");
+        return 1;
+    }
+    if (!t.n)
+        return 0;
+
+    in.lat = t.lat;
+    in.lng = t.lng;
+    in.time = t.time;
+    out.latitude = malloc(t.n * sizeof(*out.latitude));
+    out.longitude = malloc(t.n * sizeof(*out.longitude));
+    out.speed = malloc(t.n * sizeof(*out.speed));
+    out.bearing = malloc(t.n * sizeof(*out.bearing));
+    out.flags = malloc(t.n * sizeof(*out.flags));
+    if (!out.latitude || !out.longitude || !out.speed || !out.bearing ||
+        !out.flags) {
+        perror("malloc");
+        return 1;
+    }
+
+    if (test) {
+        size_t bad = check(&t, &in, &out, correction_factor, nthreads);
+
+        printf("%zu fixes checked, %zu differ\n", t.n, bad);
+        return bad != 0;
+    }
+    if (bench) {
+        benchmark(&t, &in, &out, correction_factor, nthreads);
+        return 0;
+    }
+
+    vogue_track_process_mt(&in, &out, t.n, correction_factor, nthreads);
+    for (i=0; i<t.n; i++) {
+        if (!out.flags[i])
+            continue;
+        printf("%u,%.7f,%.7f,%g,%g,%u\n", t.time[i], out.latitude[i],
+               out.longitude[i], out.speed[i], out.bearing[i], out.flags[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+/* Unit tests for the gpsd server's command handling and client output.
+ * Includes vogue_gpsd.c to get at its static functions. */
+#define _GNU_SOURCE
+#include "vogue_gpsd.c"
+#include "check.h"
+
+static struct client *new_client (int fd)
+{
+    struct client *c = calloc(1, sizeof(*c));
+
+    c->fd = fd;
+    c->events = EPOLLIN;
+    c->next = clients;
+    if (clients)
+        clients->prev = c;
+    clients = c;
+    return c;
+}
+
+static int queued (struct client *c, const char *what)
+{
+    int i;
+
+    for (i=0; i<c->count; i++)
+        if (memmem(c->queue[i]->data, c->queue[i]->len, what, strlen(what)))
+            return 1;
+    return 0;
+}
+
+static void drop_queue (struct client *c)
+{
+    int i;
+
+    for (i=0; i<c->count; i++)
+        report_put(c->queue[i]);
+    c->count = 0;
+}
+
+static void test_json_bool (void)
+{
+    CHECK(json_bool("{\"enable\":true}", "enable", 0) == 1);
+    CHECK(json_bool("{\"enable\":false}", "enable", 1) == 0);
+    CHECK(json_bool("{\"enable\": false}", "enable", 1) == 0);
+    CHECK(json_bool("{\"enable\" :\tfalse }", "enable", 1) == 0);
+    CHECK(json_bool("{ \"json\":true, \"enable\" : true }", "enable", 0) == 1);
+    CHECK(json_bool("{\"json\":false}", "enable", 1) == 1);
+    CHECK(json_bool("{\"notenable\":false}", "enable", 1) == 1);
+    CHECK(json_bool("{\"enable\":1}", "enable", 1) == 1);
+    CHECK(json_bool("", "enable", 0) == 0);
+}
+
+static void test_commands (void)
+{
+    struct client *c = new_client(-1);
+    char cmd[64];
+
+    strcpy(cmd, "?WATCH={\"enable\": true}");
+    client_command(c, cmd);
+    CHECK(c->watching);
+    CHECK(nwatchers == 1);
+    CHECK(queued(c, "\"class\":\"DEVICES\""));
+    CHECK(queued(c, "\"class\":\"WATCH\",\"enable\":true"));
+    drop_queue(c);
+
+    /* Watching twice doesn't count twice */
+    strcpy(cmd, "?WATCH={\"enable\":true}");
+    client_command(c, cmd);
+    CHECK(nwatchers == 1);
+    drop_queue(c);
+
+    strcpy(cmd, "?WATCH={\"enable\" : false}");
+    client_command(c, cmd);
+    CHECK(!c->watching);
+    CHECK(nwatchers == 0);
+    CHECK(!queued(c, "DEVICES"));
+    CHECK(queued(c, "\"class\":\"WATCH\",\"enable\":false"));
+    drop_queue(c);
+
+    strcpy(cmd, "?VERSION");
+    client_command(c, cmd);
+    CHECK(queued(c, "\"class\":\"VERSION\""));
+    drop_queue(c);
+
+    strcpy(cmd, "?POLL");
+    client_command(c, cmd);
+    CHECK(queued(c, "\"class\":\"ERROR\""));
+    drop_queue(c);
+
+    /* Empty commands, as between ";\n", are ignored */
+    cmd[0] = '\0';
+    client_command(c, cmd);
+    CHECK(c->count == 0);
+
+    clients = NULL;
+    free(c);
+}
+
+/* Commands split on ';' and newlines, with the replies written back */
+static void test_read_and_flush (void)
+{
+    static const char input[] = "?VERSION;\n?WATCH={\"enable\":true};";
+    struct client *c;
+    char buf[1024];
+    int sv[2];
+    ssize_t n;
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    c = new_client(sv[0]);
+
+    CHECK(write(sv[1], input, sizeof(input) - 1) == sizeof(input) - 1);
+    CHECK(client_read(c) == 0);
+    CHECK(c->watching);
+    CHECK(c->count == 0);
+
+    n = read(sv[1], buf, sizeof(buf) - 1);
+    CHECK(n > 0);
+    buf[n > 0 ? n : 0] = '\0';
+    CHECK(strstr(buf, "\"class\":\"VERSION\""));
+    CHECK(strstr(buf, "\"class\":\"DEVICES\""));
+    CHECK(strstr(buf, "\"class\":\"WATCH\""));
+
+    /* A peer that went away must not raise SIGPIPE */
+    close(sv[1]);
+    client_reply(c, report_new("{\"class\":\"TPV\"}\r\n"));
+    CHECK(client_flush(c) == -1);
+    CHECK(clients == NULL);
+    CHECK(nwatchers == 0);
+}
+
+/* A client that stops reading keeps only the newest reports */
+static void test_bounded_queue (void)
+{
+    struct client *c = new_client(-1);
+    struct report *r;
+    char what[32];
+    int i;
+
+    for (i=0; i<CLIENT_QUEUE + 3; i++) {
+        r = report_new("{\"n\":%d}\r\n", i);
+        client_enqueue(c, r);
+        report_put(r);
+    }
+    CHECK(c->count == CLIENT_QUEUE);
+    CHECK(!queued(c, "{\"n\":2}"));
+    snprintf(what, sizeof(what), "{\"n\":%d}", CLIENT_QUEUE + 2);
+    CHECK(queued(c, what));
+
+    drop_queue(c);
+    clients = NULL;
+    free(c);
+}
+
+static int received (int fd, char *buf, size_t size)
+{
+    ssize_t n = read(fd, buf, size - 1);
+
+    buf[n > 0 ? n : 0] = '\0';
+    return n > 0;
+}
+
+/* Reports inside the rate limit are held, and only the newest is sent
+ * once the interval is up */
+static void test_rate_limit (void)
+{
+    struct client *c;
+    char buf[1024];
+    int sv[2];
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    c = new_client(sv[0]);
+    c->watching = 1;
+    nwatchers++;
+    min_interval = 200;
+
+    publish(REPORT_TPV, report_new("{\"class\":\"TPV\",\"n\":1}\r\n"));
+    CHECK(dispatch_pending(1000) == -1);
+    CHECK(received(sv[1], buf, sizeof(buf)));
+    CHECK(strstr(buf, "\"n\":1"));
+
+    publish(REPORT_TPV, report_new("{\"class\":\"TPV\",\"n\":2}\r\n"));
+    CHECK(dispatch_pending(1050) == 150);
+    CHECK(!received(sv[1], buf, sizeof(buf)));
+
+    /* Other classes have their own interval */
+    publish(REPORT_SKY, report_new("{\"class\":\"SKY\"}\r\n"));
+    publish(REPORT_TPV, report_new("{\"class\":\"TPV\",\"n\":3}\r\n"));
+    CHECK(dispatch_pending(1100) == 100);
+    CHECK(received(sv[1], buf, sizeof(buf)));
+    CHECK(strstr(buf, "SKY"));
+    CHECK(!strstr(buf, "TPV"));
+
+    /* Nothing new arrives; the held report goes out on time anyway */
+    CHECK(dispatch_pending(1199) == 1);
+    CHECK(!received(sv[1], buf, sizeof(buf)));
+    CHECK(dispatch_pending(1200) == -1);
+    CHECK(received(sv[1], buf, sizeof(buf)));
+    CHECK(strstr(buf, "\"n\":3"));
+    CHECK(!strstr(buf, "\"n\":2"));
+    CHECK(c->held[REPORT_TPV] == NULL);
+
+    /* A client that stops watching loses what was held for it */
+    publish(REPORT_TPV, report_new("{\"class\":\"TPV\",\"n\":4}\r\n"));
+    CHECK(dispatch_pending(1300) == 100);
+    strcpy(buf, "?WATCH={\"enable\":false}");
+    client_command(c, buf);
+    CHECK(c->held[REPORT_TPV] == NULL);
+    CHECK(nwatchers == 0);
+    CHECK(dispatch_pending(1400) == -1);
+
+    close(sv[1]);
+    close(sv[0]);
+    drop_queue(c);
+    clients = NULL;
+    free(c);
+}
+
+int main (void)
+{
+    test_json_bool();
+    test_commands();
+    test_read_and_flush();
+    test_bounded_queue();
+    test_rate_limit();
+    return check_result();
+}
@@ -0,0 +1,140 @@
+/* Unit tests for the HAL session lifecycle against the simulated device:
+ * calls out of order, a failed init and its retry, and the GPS thread
+ * going idle on stop.  Includes vogue_gps.c to get at its state. */
+#include "vogue_gps.c"
+#include "check.h"
+
+static pthread_mutex_t cb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cb_wq = PTHREAD_COND_INITIALIZER;
+static int nfixes, nstatus, nsession_ends;
+
+static void location_cb (GpsLocation *location)
+{
+    (void)location;
+    pthread_mutex_lock(&cb_mutex);
+    nfixes++;
+    pthread_cond_broadcast(&cb_wq);
+    pthread_mutex_unlock(&cb_mutex);
+}
+
+static void status_cb (GpsStatus *status)
+{
+    pthread_mutex_lock(&cb_mutex);
+    nstatus++;
+    if (status->status == GPS_STATUS_SESSION_END)
+        nsession_ends++;
+    pthread_cond_broadcast(&cb_wq);
+    pthread_mutex_unlock(&cb_mutex);
+}
+
+static void sv_status_cb (GpsSvStatus *sv_info) { (void)sv_info; }
+
+static GpsCallbacks callbacks = {
+    .location_cb    = location_cb,
+    .status_cb      = status_cb,
+    .sv_status_cb   = sv_status_cb,
+};
+
+static int counted (int *counter)
+{
+    int n;
+
+    pthread_mutex_lock(&cb_mutex);
+    n = *counter;
+    pthread_mutex_unlock(&cb_mutex);
+    return n;
+}
+
+/* Waits up to 5s for *counter to reach n; returns 0 if it did */
+static int wait_for (int *counter, int n)
+{
+    struct timespec ts;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 5;
+    pthread_mutex_lock(&cb_mutex);
+    while (*counter < n && rc == 0)
+        rc = pthread_cond_timedwait(&cb_wq, &cb_mutex, &ts);
+    rc = *counter < n ? -1 : 0;
+    pthread_mutex_unlock(&cb_mutex);
+    return rc;
+}
+
+/* Before init there is no session; stop and cleanup must do nothing */
+static void test_before_init (void)
+{
+    memcpy(&vogue_callbacks, &callbacks, sizeof(callbacks));
+
+    CHECK(vogue_gps_stop() == 0);
+    vogue_gps_cleanup();
+    CHECK(need_init);
+    CHECK(gps_fd == -1);
+    CHECK(wake_pipe[0] == -1);
+    CHECK(counted(&nstatus) == 0);
+}
+
+/* A failed init leaves nothing behind and can simply be retried */
+static void test_failed_init (void)
+{
+    int busy = vogue_sim_open("sim", O_RDWR);
+
+    CHECK(busy >= 0);
+    CHECK(vogue_gps_init(&callbacks) == -EBUSY);
+    CHECK(need_init);
+    CHECK(gps_fd == -1);
+    CHECK(wake_pipe[0] == -1);
+    CHECK(vogue_gps_start() == -EBUSY);
+    CHECK(need_init);
+    vogue_gps_cleanup();
+    CHECK(counted(&nstatus) == 0);
+    vogue_sim_close(busy);
+
+    CHECK(vogue_gps_init(&callbacks) == 0);
+    CHECK(!need_init);
+    CHECK(gps_fd >= 0);
+    vogue_gps_cleanup();
+    CHECK(need_init);
+    CHECK(gps_fd == -1);
+    CHECK(wake_pipe[0] == -1);
+
+    /* cleanup must be safe to repeat */
+    vogue_gps_cleanup();
+    CHECK(need_init);
+}
+
+/* stop leaves the thread waiting for the next start, which reuses it */
+static void test_stop_start (void)
+{
+    int i;
+
+    /* start on its own brings the session up */
+    CHECK(vogue_gps_start() == 0);
+    CHECK(!need_init);
+    for (i=1; i<=3; i++) {
+        if (i > 1)
+            CHECK(vogue_gps_start() == 0);
+        CHECK(wait_for(&nfixes, counted(&nfixes) + 1) == 0);
+        CHECK(vogue_gps_stop() == 0);
+        CHECK(wait_for(&nsession_ends, i) == 0);
+        CHECK(!thread_running);
+    }
+
+    /* A second stop changes nothing */
+    CHECK(vogue_gps_stop() == 0);
+    CHECK(counted(&nsession_ends) == 3);
+
+    vogue_gps_cleanup();
+    CHECK(need_init);
+    CHECK(gps_fd == -1);
+}
+
+int main (void)
+{
+    setenv("VOGUE_SIM_PERIOD_MS", "1", 1);
+
+    test_before_init();
+    test_failed_init();
+    test_stop_start();
+    return check_result();
+}
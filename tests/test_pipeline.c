@@ -0,0 +1,188 @@
+/* Unit tests for the HAL's decode -> filter -> dispatch stages, built
+ * once with smoothing off and once with it on.  Includes vogue_gps.c to
+ * get at its static functions. */
+#include "vogue_gps.c"
+#include "check.h"
+
+static GpsLocation reported;
+static int nreported;
+
+static void location_cb (GpsLocation *location)
+{
+    reported = *location;
+    nreported++;
+}
+
+static void reset (void)
+{
+    correction_factor = 1.0;
+    last_fix = 0;
+    last_lat = last_lon = 0;
+    nreported = 0;
+}
+
+static struct gps_state state (uint32_t time, int32_t lat, int32_t lng)
+{
+    struct gps_state data;
+
+    memset(&data, 0, sizeof(data));
+    data.time = time;
+    data.lat = lat;
+    data.lng = lng;
+    return data;
+}
+
+static void test_decode (void)
+{
+    struct gps_state data = state(5, 6660000, -21960000);
+    GpsLocation location;
+
+    reset();
+    CHECK(decode_fix(&data, &location));
+    CHECK(location.flags ==
+          (GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY));
+    CHECK(location.latitude == 37.0);
+    CHECK(location.longitude == -122.0);
+    CHECK(location.accuracy == 3.0f);
+    CHECK(location.timestamp == 5);
+
+    correction_factor = 2.0;
+    CHECK(decode_fix(&data, &location));
+    CHECK(location.latitude == 18.5);
+
+    /* Same time as the last reported fix: only signal data changed */
+    filter_fix(&location);
+    CHECK(!decode_fix(&data, &location));
+}
+
+static void test_filter (void)
+{
+    struct gps_state first = state(10, 6660000, -21960000);
+    struct gps_state second = state(11, 6660010, -21960000);
+    GpsLocation location;
+    double expected;
+
+    reset();
+    decode_fix(&first, &location);
+    filter_fix(&location);
+    /* Nothing to measure the first fix from, and nothing to smooth it
+     * towards */
+    CHECK(!(location.flags & GPS_LOCATION_HAS_SPEED));
+    CHECK(!(location.flags & GPS_LOCATION_HAS_BEARING));
+    CHECK(location.latitude == 37.0);
+
+    decode_fix(&second, &location);
+    filter_fix(&location);
+    CHECK(location.flags & GPS_LOCATION_HAS_SPEED);
+    CHECK(location.flags & GPS_LOCATION_HAS_BEARING);
+    CHECK(location.bearing == 0.0);
+
+#if VOGUE_GPS_SMOOTHING
+    expected = 37.0 + VOGUE_GPS_SMOOTHING_ALPHA *
+        (vogue_track_coord(6660010, 1.0) - 37.0);
+    CHECK(location.latitude == expected);
+    CHECK_NEAR(location.speed, 6.1767 * VOGUE_GPS_SMOOTHING_ALPHA, 1e-3);
+#else
+    expected = vogue_track_coord(6660010, 1.0);
+    CHECK(location.latitude == expected);
+    CHECK_NEAR(location.speed, 6.1767, 1e-3);
+#endif
+    CHECK(location.longitude == -122.0);
+    CHECK(last_lat == location.latitude);
+    CHECK(last_fix == 11);
+}
+
+static void test_send_position (void)
+{
+    struct gps_state data = state(20, 6660000, -21960000);
+
+    reset();
+    vogue_callbacks.location_cb = location_cb;
+    CHECK(send_position_data(&data) == 1);
+    CHECK(nreported == 1);
+    CHECK(reported.latitude == 37.0);
+    CHECK(reported.timestamp == 20);
+
+    CHECK(send_position_data(&data) == 0);
+    CHECK(nreported == 1);
+}
+
+#if !VOGUE_GPS_SMOOTHING
+/* The batch API must report exactly what the HAL reports one fix at a
+ * time, including around repeated times and thread chunk boundaries */
+static void test_batch_matches (int nthreads)
+{
+    const size_t n = 4 * 8192 + 77;
+    struct vogue_track_in in;
+    struct vogue_track_out out;
+    int32_t *lat = malloc(n * sizeof(*lat));
+    int32_t *lng = malloc(n * sizeof(*lng));
+    uint32_t *time = malloc(n * sizeof(*time));
+    GpsLocation location;
+    uint32_t t = 1000;
+    size_t i, mismatches = 0, nfix = 0;
+
+    out.latitude = malloc(n * sizeof(*out.latitude));
+    out.longitude = malloc(n * sizeof(*out.longitude));
+    out.speed = malloc(n * sizeof(*out.speed));
+    out.bearing = malloc(n * sizeof(*out.bearing));
+    out.flags = malloc(n * sizeof(*out.flags));
+
+    srand(nthreads);
+    for (i=0; i<n; i++) {
+        /* Runs of up to a few dozen repeated times, so some of them
+         * cross chunk boundaries */
+        if (i == 0 || rand() % 8 == 0)
+            t += 1 + rand() % 5;
+        time[i] = t;
+        lat[i] = 6660000 + rand() % 2000;
+        lng[i] = -21960000 + rand() % 2000;
+    }
+    in.lat = lat;
+    in.lng = lng;
+    in.time = time;
+    vogue_track_process_mt(&in, &out, n, 1.0, nthreads);
+
+    reset();
+    for (i=0; i<n; i++) {
+        struct gps_state data = state(time[i], lat[i], lng[i]);
+
+        if (!decode_fix(&data, &location)) {
+            mismatches += out.flags[i] != 0;
+            continue;
+        }
+        filter_fix(&location);
+        nfix++;
+        if (out.flags[i] != location.flags ||
+            out.latitude[i] != location.latitude ||
+            out.longitude[i] != location.longitude ||
+            out.speed[i] != location.speed ||
+            out.bearing[i] != location.bearing)
+            mismatches++;
+    }
+    CHECK(mismatches == 0);
+    CHECK(nfix < n);
+
+    free(lat);
+    free(lng);
+    free(time);
+    free(out.latitude);
+    free(out.longitude);
+    free(out.speed);
+    free(out.bearing);
+    free(out.flags);
+}
+#endif
+
+int main (void)
+{
+    test_decode();
+    test_filter();
+    test_send_position();
+#if !VOGUE_GPS_SMOOTHING
+    test_batch_matches(1);
+    test_batch_matches(4);
+    test_batch_matches(5);
+#endif
+    return check_result();
+}
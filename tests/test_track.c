@@ -0,0 +1,178 @@
+/* Unit tests for the fix math in vogue_track.h and the batch API */
+#include <stdlib.h>
+#include <string.h>
+#include "vogue_track.h"
+#include "check.h"
+
+struct track {
+    int32_t *lat, *lng;
+    uint32_t *time;
+    struct vogue_track_in in;
+    struct vogue_track_out out;
+    size_t n;
+};
+
+static void track_alloc (struct track *t, size_t n)
+{
+    t->n = n;
+    t->lat = calloc(n, sizeof(*t->lat));
+    t->lng = calloc(n, sizeof(*t->lng));
+    t->time = calloc(n, sizeof(*t->time));
+    t->in.lat = t->lat;
+    t->in.lng = t->lng;
+    t->in.time = t->time;
+    t->out.latitude = calloc(n, sizeof(*t->out.latitude));
+    t->out.longitude = calloc(n, sizeof(*t->out.longitude));
+    t->out.speed = calloc(n, sizeof(*t->out.speed));
+    t->out.bearing = calloc(n, sizeof(*t->out.bearing));
+    t->out.flags = calloc(n, sizeof(*t->out.flags));
+}
+
+static void track_free (struct track *t)
+{
+    free(t->lat);
+    free(t->lng);
+    free(t->time);
+    free(t->out.latitude);
+    free(t->out.longitude);
+    free(t->out.speed);
+    free(t->out.bearing);
+    free(t->out.flags);
+}
+
+static void test_helpers (void)
+{
+    CHECK(vogue_track_coord(6660000, 1.0) == 37.0);
+    CHECK(vogue_track_coord(-21960000, 1.0) == -122.0);
+    CHECK(vogue_track_coord(6660000, 2.0) == 18.5);
+
+    CHECK(vogue_track_delta(3.0, 4.0) == 5.0);
+    CHECK(vogue_track_delta(-3.0, -4.0) == 5.0);
+
+    /* One nautical mile (1/60 degree) per second */
+    CHECK_NEAR(vogue_track_speed(1.0 / 60, 1), 1853.0, 1e-3);
+    CHECK_NEAR(vogue_track_speed(1.0 / 60, 10), 185.3, 1e-3);
+    CHECK(vogue_track_speed(0.0, 1) == 0.0);
+
+    CHECK(vogue_track_bearing(0.0, 0.0) == 0.0);
+    CHECK(vogue_track_bearing(1.0, 0.0) == 0.0);
+    CHECK_NEAR(vogue_track_bearing(1.0, 1.0), 45.0085, 1e-3);
+    CHECK_NEAR(vogue_track_bearing(-1.0, 1.0), 135.0085, 1e-3);
+    CHECK_NEAR(vogue_track_bearing(-1.0, -1.0), 225.0085, 1e-3);
+    CHECK_NEAR(vogue_track_bearing(1.0, -1.0), 315.0085, 1e-3);
+}
+
+/* A repeated time is not a new fix, and the next one is measured from
+ * the first entry with that time */
+static void test_duplicates (void)
+{
+    static const uint32_t time[] = { 1, 2, 2, 3 };
+    static const int32_t lat[] = { 6660000, 6660010, 6660500, 6660020 };
+    static const int32_t lng[] = { -21960000, -21960000, -21960500,
+                                   -21960000 };
+    const uint16_t fix = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY;
+    const uint16_t moving = GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING;
+    struct track t;
+
+    track_alloc(&t, 4);
+    memcpy(t.time, time, sizeof(time));
+    memcpy(t.lat, lat, sizeof(lat));
+    memcpy(t.lng, lng, sizeof(lng));
+    vogue_track_process(&t.in, &t.out, t.n, 1.0);
+
+    CHECK(t.out.flags[0] == fix);
+    CHECK(t.out.flags[1] == (fix | moving));
+    CHECK(t.out.flags[2] == 0);
+    CHECK(t.out.flags[3] == (fix | moving));
+    CHECK(t.out.latitude[0] == 37.0);
+    CHECK(t.out.speed[0] == 0.0);
+    CHECK_NEAR(t.out.speed[1], 6.1767, 1e-3);
+    CHECK(t.out.speed[2] == 0.0);
+    CHECK_NEAR(t.out.speed[3], 6.1767, 1e-3);
+    CHECK(t.out.bearing[3] == 0.0);
+
+    track_free(&t);
+}
+
+/* A position of 0,0 means the next fix has nothing to measure from */
+static void test_no_position (void)
+{
+    struct track t;
+
+    track_alloc(&t, 3);
+    t.time[0] = 1;
+    t.time[1] = 2;
+    t.time[2] = 3;
+    t.lat[2] = 6660000;
+    t.lng[2] = -21960000;
+    vogue_track_process(&t.in, &t.out, t.n, 1.0);
+
+    CHECK(!(t.out.flags[1] & GPS_LOCATION_HAS_SPEED));
+    CHECK(!(t.out.flags[2] & GPS_LOCATION_HAS_SPEED));
+    CHECK(t.out.speed[2] == 0.0);
+
+    track_free(&t);
+}
+
+static int outputs_equal (const struct vogue_track_out *a,
+                          const struct vogue_track_out *b, size_t n)
+{
+    return !memcmp(a->latitude, b->latitude, n * sizeof(*a->latitude)) &&
+        !memcmp(a->longitude, b->longitude, n * sizeof(*a->longitude)) &&
+        !memcmp(a->speed, b->speed, n * sizeof(*a->speed)) &&
+        !memcmp(a->bearing, b->bearing, n * sizeof(*a->bearing)) &&
+        !memcmp(a->flags, b->flags, n * sizeof(*a->flags));
+}
+
+/* Threads must agree with a single pass, including where a run of
+ * repeated times straddles the boundary between two threads' chunks */
+static void test_threads (size_t n, int nthreads)
+{
+    struct track single, mt;
+    size_t chunk = (n + nthreads - 1) / nthreads;
+    uint32_t time = 1000;
+    size_t i, b;
+
+    track_alloc(&single, n);
+    track_alloc(&mt, n);
+    srand(n);
+    for (i=0; i<n; i++) {
+        size_t off = i % chunk;
+        int advance = i == 0 || rand() % 4;
+
+        /* Entries b-3 .. b+2 around each boundary b share one new time */
+        if (i >= chunk - 3 && (off >= chunk - 3 || off < 3))
+            advance = off == chunk - 3;
+        if (advance)
+            time += 1 + rand() % 3;
+        single.time[i] = time;
+        single.lat[i] = 6660000 + rand() % 1000;
+        single.lng[i] = -21960000 + rand() % 1000;
+    }
+    memcpy(mt.time, single.time, n * sizeof(*mt.time));
+    memcpy(mt.lat, single.lat, n * sizeof(*mt.lat));
+    memcpy(mt.lng, single.lng, n * sizeof(*mt.lng));
+
+    vogue_track_process(&single.in, &single.out, n, 1.0);
+    vogue_track_process_mt(&mt.in, &mt.out, n, 1.0, nthreads);
+    CHECK(outputs_equal(&single.out, &mt.out, n));
+    /* Only the first entry of each straddling run is a new fix */
+    for (b=chunk; b<n; b+=chunk) {
+        CHECK(single.out.flags[b-3] != 0);
+        CHECK(single.out.flags[b] == 0);
+    }
+
+    track_free(&single);
+    track_free(&mt);
+}
+
+int main (void)
+{
+    test_helpers();
+    test_duplicates();
+    test_no_position();
+    test_threads(4 * 8192, 4);
+    test_threads(4 * 8192 + 123, 4);
+    test_threads(7 * 5000, 7);
+    return check_result();
+}
@@ -0,0 +1,43 @@
+#ifndef _VOGUE_CONFIG_H_
+#define _VOGUE_CONFIG_H_
+
+/* Build-time configuration.  Everything here can be overridden with -D;
+ * a stage that is switched off compiles to nothing. */
+
+/* The kernel driver's device node */
+#ifndef VOGUE_GPS_DEVICE
+# define VOGUE_GPS_DEVICE "/dev/vogue_gps"
+#endif
+
+/* Trace every step of the HAL to VOGUE_GPS_LOG_FILE */
+#ifndef VOGUE_GPS_DEBUG
+# define VOGUE_GPS_DEBUG 1
+#endif
+
+#ifndef VOGUE_GPS_LOG_FILE
+# define VOGUE_GPS_LOG_FILE "/sdcard/gps"
+#endif
+
+/* Exponential smoothing of reported positions.  Each fix moves
+ * VOGUE_GPS_SMOOTHING_ALPHA of the way from the last reported position
+ * towards the new one. */
+#ifndef VOGUE_GPS_SMOOTHING
+# define VOGUE_GPS_SMOOTHING 0
+#endif
+
+#ifndef VOGUE_GPS_SMOOTHING_ALPHA
+# define VOGUE_GPS_SMOOTHING_ALPHA 0.5
+#endif
+
+/* Fan fixes out to gpsd clients on this socket; see vogue_gpsd.h.  Left
+ * undefined by default, and the build leaves vogue_gpsd.c out of the
+ * library unless it is set. */
+/* #define VOGUE_GPSD_SOCKET "/dev/socket/gpsd" */
+
+/* Talk to the simulated device in vogue_sim.c instead of the kernel
+ * driver, for host builds */
+#ifndef VOGUE_GPS_SIM
+# define VOGUE_GPS_SIM 0
+#endif
+
+#endif
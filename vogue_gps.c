@@ -1,35 +1,71 @@
 
 #include <pthread.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
+#include <string.h>
 #include <stdio.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
 #include <math.h>
+#include "vogue_config.h"
 #include "gps.h"
 #include "vogue_gps.h"
+#include "vogue_track.h"
+#ifdef VOGUE_GPSD_SOCKET
+# include "vogue_gpsd.h"
+#endif
 
-#define VOGUE_GPS_DEVICE "/dev/vogue_gps"
+#if VOGUE_GPS_SIM
+# include "vogue_sim.h"
+# define dev_open   vogue_sim_open
+# define dev_ioctl  vogue_sim_ioctl
+# define dev_close  vogue_sim_close
+#else
+# define dev_open   open
+# define dev_ioctl  ioctl
+# define dev_close  close
+#endif
 
-#define DEBUG
+#if VOGUE_GPS_DEBUG
+static void gps_log (const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
 
-#ifdef DEBUG
-# define GPS_LOG system
+static void gps_log (const char *fmt, ...)
+{
+    va_list ap;
+    FILE *f;
+
+    f = fopen(VOGUE_GPS_LOG_FILE, "a");
+    if (!f)
+        return;
+    va_start(ap, fmt);
+    vfprintf(f, fmt, ap);
+    va_end(ap);
+    fputc('\n', f);
+    fclose(f);
+}
+# define GPS_LOG gps_log
 #else
-# define GPS_LOG(...) do { } while (0);
+# define GPS_LOG(...) do { } while (0)
 #endif
 
 static GpsCallbacks vogue_callbacks;
 static pthread_t gps_thread;
-int gps_fd;
+int gps_fd = -1;
 double correction_factor;
 
-static pthread_mutex_t thread_mutex;
+/* Writing a byte here kicks the thread out of select() so it notices
+ * stop/cleanup right away instead of at the next fix timeout */
+static int wake_pipe[2] = { -1, -1 };
+
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int thread_running;
-static pthread_cond_t thread_wq;
+static pthread_cond_t thread_wq = PTHREAD_COND_INITIALIZER;
 static int fix_freq = 60000;
 
 static void send_status (GpsStatusValue sv)
@@ -40,103 +76,106 @@ static void send_status (GpsStatusValue sv)
     vogue_callbacks.status_cb(&status);
 }
 
-static void send_signal_data (struct gps_state data)
+static void send_signal_data (const struct gps_state *data)
 {
     GpsSvStatus sv_info;
     int i;
 
     sv_info.num_svs = 0;
     for (i=0; i<MAX_SATELLITES; i++) {
-        if (!data.sat_state[i].sat_no)
+        if (!data->sat_state[i].sat_no)
             break;
 
         sv_info.num_svs++;
-        sv_info.sv_list[i].prn = data.sat_state[i].sat_no;
+        sv_info.sv_list[i].prn = data->sat_state[i].sat_no;
         sv_info.sv_list[i].snr
-            = data.sat_state[i].signal_strength;
+            = data->sat_state[i].signal_strength;
     }
 
     vogue_callbacks.sv_status_cb(&sv_info);
+#ifdef VOGUE_GPSD_SOCKET
+    vogue_gpsd_send_sv_status(&sv_info);
+#endif
 }
 
-static int send_position_data (struct gps_state data)
-{
-    static uint32_t last_fix;
-    static double last_lat, last_lon;
-    float position_delta;
-    uint32_t time_delta;
-    GpsLocation location;
-    char cmd[256];
+/* Position pipeline: decode -> filter -> dispatch.  The stages are
+ * inlined into send_position_data, and the optional parts of each are
+ * compiled in or out by vogue_config.h. */
 
+/* The last fix we reported */
+static uint32_t last_fix;
+static double last_lat, last_lon;
+
+/* Returns 0 if there is no new fix to report */
+static inline int decode_fix (const struct gps_state *data,
+                              GpsLocation *location)
+{
     /* If the fix time hasn't changed, the kernel was probably just
      * alerting us to new signal data */
-    if (data.time == last_fix)
+    if (data->time == last_fix)
         return 0;
 
-    time_delta = data.time - last_fix;
-    last_fix = data.time;
+    memset(location, 0, sizeof(*location));
+    location->flags |= GPS_LOCATION_HAS_LAT_LONG;
+    location->flags |= GPS_LOCATION_HAS_ACCURACY;
+    location->latitude = vogue_track_coord(data->lat, correction_factor);
+    location->longitude = vogue_track_coord(data->lng, correction_factor);
+    location->accuracy = 3.0;
+    location->timestamp = data->time;
+    return 1;
+}
 
-    memset(&location, 0, sizeof(location));
-    location.flags |= GPS_LOCATION_HAS_LAT_LONG;
-    location.flags |= GPS_LOCATION_HAS_ACCURACY;
-    location.latitude = ((double)data.lat) / 180000.0;
-    location.latitude /= correction_factor;
-    location.longitude = ((double)data.lng) / 180000.0;
-    location.longitude /= correction_factor;
+static inline void filter_fix (GpsLocation *location)
+{
+    uint32_t time_delta = location->timestamp - last_fix;
+    double position_delta;
 
-    /* Compute speed and bearing */
+#if VOGUE_GPS_SMOOTHING
     if (last_lat && last_lon) {
-        position_delta = location.latitude - last_lat;
-        position_delta *= position_delta;
-        position_delta += (location.longitude - last_lon) *
-            (location.longitude - last_lon);
-        position_delta = sqrt(position_delta);
-        /* Nautical miles per second */
-        location.speed = 60 * position_delta / time_delta;
-        /* Convert to meters per second (assuming near sea level) */
-        location.speed *= 1853.0;
-        location.flags |= GPS_LOCATION_HAS_SPEED;
-
-        if (location.longitude != last_lon) {
-            location.bearing = fabs(location.latitude - last_lat) / 
-                fabs(location.longitude - last_lon);
-            location.bearing = atan(location.bearing) * 360 / (6.282);
-        } else {
-            location.bearing = 0.0;
-        }
-
-        if ((location.latitude - last_lat) < 0) {
-            if ((location.longitude - last_lon) < 0) {
-                location.bearing += 180.0;
-            } else {
-                location.bearing += 90.0;
-            }
-        } else if ((location.longitude - last_lon) < 0) {
-            location.bearing += 270.0;
-        }
-        if (location.bearing >= 360.0)
-            location.bearing -= 360.0;
-        location.flags |= GPS_LOCATION_HAS_BEARING;
-#ifdef DEBUG
-        snprintf(cmd, 256, "echo speed %10g bearing %10g >> /sdcard/gps",
-                 location.speed, location.bearing);
-        system(cmd);
+        location->latitude = last_lat + VOGUE_GPS_SMOOTHING_ALPHA *
+            (location->latitude - last_lat);
+        location->longitude = last_lon + VOGUE_GPS_SMOOTHING_ALPHA *
+            (location->longitude - last_lon);
+    }
 #endif
+
+    /* Compute speed and bearing */
+    if (last_lat && last_lon) {
+        position_delta = vogue_track_delta(location->latitude - last_lat,
+                                           location->longitude - last_lon);
+        location->speed = vogue_track_speed(position_delta, time_delta);
+        location->flags |= GPS_LOCATION_HAS_SPEED;
+
+        location->bearing = vogue_track_bearing(location->latitude - last_lat,
+                                                location->longitude - last_lon);
+        location->flags |= GPS_LOCATION_HAS_BEARING;
+        GPS_LOG("speed %10g bearing %10g", location->speed, location->bearing);
     }
 
-    last_lat = location.latitude;
-    last_lon = location.longitude;
-    location.accuracy = 3.0;
-    location.timestamp = data.time;
+    last_fix = location->timestamp;
+    last_lat = location->latitude;
+    last_lon = location->longitude;
+}
+
+static inline void dispatch_fix (GpsLocation *location)
+{
+    GPS_LOG("lock");
+    GPS_LOG("coords %10g %10g", location->latitude, location->longitude);
 
-    GPS_LOG("echo lock >> /sdcard/gps");
-#ifdef DEBUG
-    snprintf(cmd, 256, "echo coords %10g %10g >> /sdcard/gps", location.latitude,
-            location.longitude);
-    system(cmd);
+    vogue_callbacks.location_cb(location);
+#ifdef VOGUE_GPSD_SOCKET
+    vogue_gpsd_send_location(location);
 #endif
+}
+
+static int send_position_data (const struct gps_state *data)
+{
+    GpsLocation location;
 
-    vogue_callbacks.location_cb(&location);
+    if (!decode_fix(data, &location))
+        return 0;
+    filter_fix(&location);
+    dispatch_fix(&location);
     return 1;
 }
 
@@ -148,27 +187,51 @@ static int get_next_fix (void)
     return next_fix;
 }
 
+static void wake_thread (void)
+{
+    char c = 0;
+    int rc;
+
+    do {
+        rc = write(wake_pipe[1], &c, 1);
+    } while (rc < 0 && errno == EINTR);
+    /* EAGAIN just means a wakeup is already pending */
+}
+
+static void drain_wake_pipe (void)
+{
+    char buf[64];
+
+    while (read(wake_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
 static void *vogue_gps_thread (void *arg)
 {
     (void)arg;
     int msec_to_next_fix = get_next_fix();
-#ifdef DEBUG
-    char cmd[256];
+    int in_session = 0;
 
-    snprintf(cmd, sizeof(cmd), "echo thread pid %d >> /sdcard/gps", getpid());
-    system(cmd);
-#endif
+    GPS_LOG("thread pid %d", getpid());
 
-    GPS_LOG("echo thread 1 >> /sdcard/gps");
+    GPS_LOG("thread 1");
 
     /* Wait until we're signalled to start */
     pthread_mutex_lock(&thread_mutex);
 restart:
-    GPS_LOG("echo thread 1a >> /sdcard/gps");
+    GPS_LOG("thread 1a");
+    /* Tell the framework once the device really isn't being read any
+     * more, whether that was stop, cleanup or the end of a one-shot */
+    if (in_session) {
+        in_session = 0;
+        pthread_mutex_unlock(&thread_mutex);
+        send_status(GPS_STATUS_SESSION_END);
+        pthread_mutex_lock(&thread_mutex);
+    }
     while (!thread_running) {
         pthread_cond_wait(&thread_wq, &thread_mutex);
     }
-    GPS_LOG("echo thread 2 >> /sdcard/gps");
+    GPS_LOG("thread 2");
 
     /* 2 means we should quit */
     if (thread_running == 2) {
@@ -177,26 +240,28 @@ restart:
     }
     pthread_mutex_unlock(&thread_mutex);
 
-    GPS_LOG("echo thread 3 >> /sdcard/gps");
+    GPS_LOG("thread 3");
+    in_session = 1;
 
     for (;;) {
         struct gps_state data;
         struct timeval select_tv, before_tv, after_tv;
-        fd_set set, empty;
-        int rc;
+        fd_set set;
+        int rc, maxfd;
 
         do {
             int msec_elapsed;
 
             select_tv.tv_sec = msec_to_next_fix / 1000;
-            select_tv.tv_usec = (msec_to_next_fix % 1000) / 1000;
+            select_tv.tv_usec = (msec_to_next_fix % 1000) * 1000;
 
             FD_ZERO(&set);
-            FD_ZERO(&empty);
             FD_SET(gps_fd, &set);
+            FD_SET(wake_pipe[0], &set);
+            maxfd = gps_fd > wake_pipe[0] ? gps_fd : wake_pipe[0];
 
             gettimeofday(&before_tv, NULL);
-            rc = select(gps_fd+1, &set, &empty, &empty, &select_tv);
+            rc = select(maxfd+1, &set, NULL, NULL, &select_tv);
             gettimeofday(&after_tv, NULL);
 
             /* If we got woken up early by a signal, we want to decrease our
@@ -209,14 +274,20 @@ restart:
             if (msec_to_next_fix < 0)
                 msec_to_next_fix = 0;
 
+            if (rc > 0 && FD_ISSET(wake_pipe[0], &set)) {
+                drain_wake_pipe();
+                rc--;
+            }
+
             pthread_mutex_lock(&thread_mutex);
             if (thread_running != 1)
                 goto restart;
             pthread_mutex_unlock(&thread_mutex);
-        } while (rc < 0 && errno == EINTR);
+        } while ((rc < 0 && errno == EINTR) ||
+                 (rc == 0 && msec_to_next_fix > 0));
 
         if (rc < 0) {
-            GPS_LOG("echo select error >> /sdcard/gps");
+            GPS_LOG("select error");
             perror("select");
             continue;
         }
@@ -224,27 +295,30 @@ restart:
         if (!rc) {
             /* fix_freq has elapsed with no data from the GPS.  better tell it
              * explicitly that we want a new fix */
-            GPS_LOG("echo select timeout >> /sdcard/gps");
-            ioctl(gps_fd, VGPS_IOC_NEW_FIX);
+            GPS_LOG("select timeout");
+            dev_ioctl(gps_fd, VGPS_IOC_NEW_FIX);
             msec_to_next_fix = get_next_fix();
             continue;
         }
 
-        GPS_LOG("echo thread 6 >> /sdcard/gps");
+        GPS_LOG("thread 6");
 
         do {
             rc = read(gps_fd, &data, sizeof(struct gps_state));
         } while (rc < 0 && errno == EINTR);
 
-        if (rc < 0) {
-            GPS_LOG("echo read error >> /sdcard/gps");
-            perror("read");
+        /* Don't hand a partly filled record to the callbacks */
+        if (rc != sizeof(data)) {
+            GPS_LOG("read error");
+            if (rc < 0)
+                perror("read");
+            continue;
         }
 
-        GPS_LOG("echo thread 7 >> /sdcard/gps");
+        GPS_LOG("thread 7");
 
-        send_signal_data(data);
-        rc = send_position_data(data);
+        send_signal_data(&data);
+        rc = send_position_data(&data);
 
         if (rc) {
             /* We sent new position data, so reset the timer */
@@ -253,6 +327,7 @@ restart:
 
         /* fix frequency of zero means "one-shot mode" */
         if (!fix_freq) {
+            pthread_mutex_lock(&thread_mutex);
             thread_running=0;
             goto restart;
         }
@@ -263,48 +338,82 @@ restart:
 
 static int need_init=1;
 
+static void close_fds (void)
+{
+    if (wake_pipe[0] >= 0) {
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+        wake_pipe[0] = wake_pipe[1] = -1;
+    }
+    if (gps_fd >= 0) {
+        dev_close(gps_fd);
+        gps_fd = -1;
+    }
+}
+
+/* Only clears need_init once everything is set up, so a failed init can
+ * simply be retried by the next init or start */
 static int core_init()
 {
-    need_init = 0;
     int rc;
     struct gps_info info;
-    pthread_mutexattr_t attr;
 
-    gps_fd = open(VOGUE_GPS_DEVICE, O_RDWR);
+    gps_fd = dev_open(VOGUE_GPS_DEVICE, O_RDWR);
     if (gps_fd < 0) {
+        rc = -errno;
         perror("open");
-        return -errno;
+        return rc;
     }
 
-    GPS_LOG("echo ioctl >> /sdcard/gps");
-    rc = ioctl(gps_fd, VGPS_IOC_INFO, &info);
+    GPS_LOG("ioctl");
+    rc = dev_ioctl(gps_fd, VGPS_IOC_INFO, &info);
     if (rc < 0) {
+        rc = -errno;
         perror("ioctl");
-        return -errno;
+        goto err;
     }
 
-    GPS_LOG("echo version >> /sdcard/gps");
+    GPS_LOG("version");
     if (info.version != GPS_VERSION) {
         fprintf(stderr, "wrong GPS version");
-        return -1;
+        rc = -1;
+        goto err;
     }
     correction_factor = info.correction_factor;
 
-    pthread_mutexattr_init(&attr);
-    pthread_mutex_init(&thread_mutex, &attr);
-    pthread_cond_init(&thread_wq, NULL);
+    if (pipe(wake_pipe) < 0) {
+        rc = -errno;
+        perror("pipe");
+        goto err;
+    }
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+
     thread_running = 0;
-    pthread_create(&gps_thread, NULL, vogue_gps_thread, NULL);
+    rc = pthread_create(&gps_thread, NULL, vogue_gps_thread, NULL);
+    if (rc) {
+        rc = -rc;
+        goto err;
+    }
 
+#ifdef VOGUE_GPSD_SOCKET
+    /* Not fatal; the framework still gets its fixes */
+    if (vogue_gpsd_start(VOGUE_GPSD_SOCKET, VOGUE_GPS_DEVICE,
+                         GPSD_MIN_INTERVAL_MS))
+        GPS_LOG("gpsd server failed");
+#endif
+
+    need_init = 0;
     return 0;
+
+err:
+    close_fds();
+    return rc;
 }
 
 static int vogue_gps_init (GpsCallbacks *callbacks)
 {
     int rc;
-#ifdef DEBUG
-    char cmd[256];
-#endif
 
     if (need_init) {
         rc = core_init();
@@ -312,21 +421,18 @@ static int vogue_gps_init (GpsCallbacks *callbacks)
             return rc;
     }
 
-    GPS_LOG("echo init >> /sdcard/gps");
-#ifdef DEBUG
-    snprintf(cmd, sizeof(cmd), "echo %d >> /sdcard/gps", getpid());
-    system(cmd);
-#endif
+    GPS_LOG("init");
+    GPS_LOG("%d", getpid());
     memcpy(&vogue_callbacks, callbacks, sizeof(GpsCallbacks));
 
-    GPS_LOG("echo done >> /sdcard/gps");
+    GPS_LOG("done");
     return 0;
 }
 
 static void start_thread(void)
 {
     if (!thread_running) {
-        GPS_LOG("echo thread not running >> /sdcard/gps");
+        GPS_LOG("thread not running");
         pthread_mutex_lock(&thread_mutex);
         thread_running = 1;
         pthread_cond_broadcast(&thread_wq);
@@ -344,16 +450,16 @@ static int vogue_gps_start (void)
             return rc;
     }
 
-    GPS_LOG("echo start >> /sdcard/gps");
+    GPS_LOG("start");
     if (!thread_running) {
-        GPS_LOG("echo need start >> /sdcard/gps");
-        rc = ioctl(gps_fd, VGPS_IOC_ENABLE);
+        GPS_LOG("need start");
+        rc = dev_ioctl(gps_fd, VGPS_IOC_ENABLE);
         if (rc < 0)
             return rc;
 
         send_status(GPS_STATUS_SESSION_BEGIN);
 
-        GPS_LOG("echo start 1 >> /sdcard/gps");
+        GPS_LOG("start 1");
         start_thread();
     }
     return 0;
@@ -361,34 +467,45 @@ static int vogue_gps_start (void)
 
 static int vogue_gps_stop (void)
 {
-    GPS_LOG("echo stop >> /sdcard/gps");
+    GPS_LOG("stop");
+    if (need_init)
+        return 0;
     if (thread_running) {
         pthread_mutex_lock(&thread_mutex);
         thread_running = 0;
         pthread_mutex_unlock(&thread_mutex);
+        wake_thread();
     }
-    ioctl(gps_fd, VGPS_IOC_DISABLE);
+    dev_ioctl(gps_fd, VGPS_IOC_DISABLE);
     send_status(GPS_STATUS_ENGINE_OFF);
     return 0;
 }
 
 static void vogue_gps_set_freq (int freq)
 {
-    GPS_LOG("echo set_freq >> /sdcard/gps");
+    GPS_LOG("set_freq");
     fix_freq = freq;
 }
 
 static void vogue_gps_cleanup (void)
 {
-    GPS_LOG("echo cleanup >> /sdcard/gps");
+    GPS_LOG("cleanup");
+    if (need_init)
+        return;
     vogue_gps_stop();
-#if 0
+
     pthread_mutex_lock(&thread_mutex);
     thread_running = 2;
     pthread_cond_broadcast(&thread_wq);
     pthread_mutex_unlock(&thread_mutex);
-    close(gps_fd);
+    wake_thread();
+    pthread_join(gps_thread, NULL);
+#ifdef VOGUE_GPSD_SOCKET
+    vogue_gpsd_stop();
 #endif
+
+    close_fds();
+    need_init = 1;
 }
 
 static int vogue_gps_inject (GpsUtcTime time, int64_t time_ref, int uncert)
@@ -406,7 +523,7 @@ static void vogue_gps_aids (GpsAidingData flags)
 
 static int vogue_gps_set_mode (GpsPositionMode mode, int freq)
 {
-    GPS_LOG("echo set_mode >> /sdcard/gps");
+    GPS_LOG("set_mode");
     fix_freq = freq;
     return 0;
 }
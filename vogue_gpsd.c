@@ -0,0 +1,648 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "gps.h"
+#include "vogue_gpsd.h"
+
+#define MAX_EVENTS      64
+/* Reports queued per client before the oldest ones get dropped */
+#define CLIENT_QUEUE    8
+#define CLIENT_INBUF    256
+
+enum {
+    REPORT_TPV,
+    REPORT_SKY,
+    NREPORTS,
+};
+
+/* A serialized report, shared by every client it is queued on.  The
+ * reference count isn't atomic.  That is only safe because a report in
+ * pending[] is never shared: it has the single reference publish() gave
+ * it, so publish() and vogue_gpsd_stop() can drop it from their own
+ * threads.  Only the I/O thread takes more references, and only after
+ * taking the report out of pending[]. */
+struct report {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+struct client {
+    struct client *prev, *next;
+    int fd;
+    int watching;
+    uint32_t events;
+    /* queue[0] is being written, starting at offset */
+    struct report *queue[CLIENT_QUEUE];
+    int count;
+    size_t offset;
+    long long last_sent[NREPORTS];
+    /* Newest report of each class held back by the rate limit */
+    struct report *held[NREPORTS];
+    char in[CLIENT_INBUF];
+    size_t inlen;
+};
+
+static pthread_t gpsd_thread;
+static pthread_mutex_t gpsd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int gpsd_running;
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static int gpsd_wake[2] = { -1, -1 };
+static char gpsd_path[108];
+static char gpsd_device[64];
+static int min_interval;
+
+/* Latest report of each class not yet picked up by the I/O thread,
+ * protected by gpsd_mutex */
+static struct report *pending[NREPORTS];
+
+/* Only the I/O thread touches the client list */
+static struct client *clients;
+/* Read without locking by the publishers; a stale value only costs one
+ * wasted or skipped serialization */
+static volatile int nwatchers;
+
+/* epoll data for the two non-client descriptors */
+static int listen_tag, wake_tag;
+
+static long long now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static struct report *report_new (const char *fmt, ...)
+{
+    struct report *r;
+    char buf[2048];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0 || len >= (int)sizeof(buf))
+        return NULL;
+
+    r = malloc(sizeof(*r) + len);
+    if (!r)
+        return NULL;
+    r->refs = 1;
+    r->len = len;
+    memcpy(r->data, buf, len);
+    return r;
+}
+
+static void report_put (struct report *r)
+{
+    if (--r->refs == 0)
+        free(r);
+}
+
+static void wake_io_thread (void)
+{
+    char c = 0;
+    int rc;
+
+    do {
+        rc = write(gpsd_wake[1], &c, 1);
+    } while (rc < 0 && errno == EINTR);
+}
+
+static void client_drop_held (struct client *c)
+{
+    int i;
+
+    for (i=0; i<NREPORTS; i++) {
+        if (c->held[i]) {
+            report_put(c->held[i]);
+            c->held[i] = NULL;
+        }
+    }
+}
+
+static void client_close (struct client *c)
+{
+    int i;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    for (i=0; i<c->count; i++)
+        report_put(c->queue[i]);
+    client_drop_held(c);
+    if (c->watching)
+        nwatchers--;
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        clients = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    free(c);
+}
+
+/* Takes a reference on r */
+static void client_enqueue (struct client *c, struct report *r)
+{
+    if (c->count == CLIENT_QUEUE) {
+        /* Slow reader: drop the oldest report that hasn't been started */
+        int drop = c->offset ? 1 : 0;
+
+        report_put(c->queue[drop]);
+        memmove(&c->queue[drop], &c->queue[drop + 1],
+                (CLIENT_QUEUE - drop - 1) * sizeof(c->queue[0]));
+        c->count--;
+    }
+    r->refs++;
+    c->queue[c->count++] = r;
+}
+
+/* Returns -1 if the client went away and has been freed */
+static int client_flush (struct client *c)
+{
+    struct iovec iov[CLIENT_QUEUE];
+    struct msghdr msg;
+    struct epoll_event ev;
+    uint32_t events;
+    ssize_t n;
+    int i;
+
+    if (c->count) {
+        for (i=0; i<c->count; i++) {
+            iov[i].iov_base = c->queue[i]->data;
+            iov[i].iov_len = c->queue[i]->len;
+        }
+        iov[0].iov_base = (char *)iov[0].iov_base + c->offset;
+        iov[0].iov_len -= c->offset;
+
+        /* sendmsg rather than writev: a client that has gone away must
+         * not take the whole process down with SIGPIPE */
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = c->count;
+        do {
+            n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && errno != EAGAIN) {
+            client_close(c);
+            return -1;
+        }
+        if (n < 0)
+            n = 0;
+
+        n += c->offset;
+        for (i=0; n > 0 && (size_t)n >= c->queue[i]->len; i++) {
+            n -= c->queue[i]->len;
+            report_put(c->queue[i]);
+        }
+        c->count -= i;
+        memmove(&c->queue[0], &c->queue[i], c->count * sizeof(c->queue[0]));
+        c->offset = n > 0 ? n : 0;
+    }
+
+    /* Only ask for EPOLLOUT while something is queued */
+    events = EPOLLIN | (c->count ? EPOLLOUT : 0);
+    if (events != c->events) {
+        ev.events = events;
+        ev.data.ptr = c;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+    return 0;
+}
+
+static void client_reply (struct client *c, struct report *r)
+{
+    if (!r)
+        return;
+    client_enqueue(c, r);
+    report_put(r);
+}
+
+/* Value of a "key":true/false member anywhere in json, or def if there
+ * is none.  Not a JSON parser, but enough for gpsd's commands. */
+static int json_bool (const char *json, const char *key, int def)
+{
+    size_t len = strlen(key);
+    const char *p = json;
+
+    while ((p = strstr(p, key))) {
+        if (p == json || p[-1] != '"' || p[len] != '"') {
+            p += len;
+            continue;
+        }
+        p += len + 1;
+        p += strspn(p, " \t");
+        if (*p != ':')
+            continue;
+        p++;
+        p += strspn(p, " \t");
+        if (!strncmp(p, "true", 4))
+            return 1;
+        if (!strncmp(p, "false", 5))
+            return 0;
+        return def;
+    }
+    return def;
+}
+
+static void client_command (struct client *c, char *cmd)
+{
+    if (!strncmp(cmd, "?WATCH", 6)) {
+        int enable = json_bool(cmd, "enable", 1);
+
+        if (enable && !c->watching)
+            nwatchers++;
+        else if (!enable && c->watching)
+            nwatchers--;
+        c->watching = enable;
+        if (!enable)
+            client_drop_held(c);
+
+        if (enable)
+            client_reply(c, report_new(
+                "{\"class\":\"DEVICES\",\"devices\":[{\"class\":\"DEVICE\","
+                "\"path\":\"%s\",\"driver\":\"vogue\"}]}\r\n", gpsd_device));
+        client_reply(c, report_new(
+            "{\"class\":\"WATCH\",\"enable\":%s,\"json\":%s}\r\n",
+            enable ? "true" : "false", enable ? "true" : "false"));
+    } else if (!strncmp(cmd, "?VERSION", 8)) {
+        client_reply(c, report_new(
+            "{\"class\":\"VERSION\",\"release\":\"vogue\",\"rev\":\"vogue\","
+            "\"proto_major\":3,\"proto_minor\":1}\r\n"));
+    } else if (cmd[0]) {
+        client_reply(c, report_new(
+            "{\"class\":\"ERROR\",\"message\":\"Unrecognized request\"}\r\n"));
+    }
+}
+
+/* Returns -1 if the client went away and has been freed */
+static int client_read (struct client *c)
+{
+    size_t i, start;
+    ssize_t n;
+
+    do {
+        n = read(c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen - 1);
+    } while (n < 0 && errno == EINTR);
+    if (n == 0 || (n < 0 && errno != EAGAIN)) {
+        client_close(c);
+        return -1;
+    }
+    if (n < 0)
+        return 0;
+    c->inlen += n;
+
+    /* Commands end in ';' or a newline */
+    start = 0;
+    for (i=0; i<c->inlen; i++) {
+        if (c->in[i] == ';' || c->in[i] == '\n' || c->in[i] == '\r') {
+            c->in[i] = '\0';
+            client_command(c, c->in + start);
+            start = i + 1;
+        }
+    }
+    c->inlen -= start;
+    memmove(c->in, c->in + start, c->inlen);
+    /* Too long to be anything we understand */
+    if (c->inlen == sizeof(c->in) - 1)
+        c->inlen = 0;
+
+    return client_flush(c);
+}
+
+static void accept_clients (void)
+{
+    struct epoll_event ev;
+    struct client *c;
+    int fd;
+
+    for (;;) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                perror("accept");
+            return;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->events = EPOLLIN;
+        ev.events = c->events;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->next = clients;
+        if (clients)
+            clients->prev = c;
+        clients = c;
+
+        client_reply(c, report_new(
+            "{\"class\":\"VERSION\",\"release\":\"vogue\",\"rev\":\"vogue\","
+            "\"proto_major\":3,\"proto_minor\":1}\r\n"));
+        client_flush(c);
+    }
+}
+
+/* Hands every watching client the newest report of each class.  A
+ * client that got a report of that class less than min_interval ago
+ * holds on to the newest one instead, and gets it once the interval is
+ * up.  Returns the ms until the next held report is due, or -1 if none
+ * is held. */
+static int dispatch_pending (long long now)
+{
+    struct report *reports[NREPORTS];
+    struct client *c, *next;
+    long long due, next_due = -1;
+    int i, queued;
+
+    pthread_mutex_lock(&gpsd_mutex);
+    memcpy(reports, pending, sizeof(reports));
+    memset(pending, 0, sizeof(pending));
+    pthread_mutex_unlock(&gpsd_mutex);
+
+    for (c=clients; c; c=next) {
+        next = c->next;
+        if (!c->watching)
+            continue;
+
+        queued = 0;
+        for (i=0; i<NREPORTS; i++) {
+            if (reports[i]) {
+                if (c->held[i])
+                    report_put(c->held[i]);
+                reports[i]->refs++;
+                c->held[i] = reports[i];
+            }
+            if (!c->held[i])
+                continue;
+            due = c->last_sent[i] + min_interval;
+            if (c->last_sent[i] && now < due) {
+                if (next_due < 0 || due < next_due)
+                    next_due = due;
+                continue;
+            }
+            c->last_sent[i] = now;
+            client_enqueue(c, c->held[i]);
+            report_put(c->held[i]);
+            c->held[i] = NULL;
+            queued = 1;
+        }
+        if (queued)
+            client_flush(c);
+    }
+
+    for (i=0; i<NREPORTS; i++)
+        if (reports[i])
+            report_put(reports[i]);
+
+    return next_due < 0 ? -1 : (int)(next_due - now);
+}
+
+static void *vogue_gpsd_thread (void *arg)
+{
+    struct epoll_event events[MAX_EVENTS];
+    char buf[64];
+    int i, n, running, timeout = -1;
+
+    (void)arg;
+
+    for (;;) {
+        /* Wakes up in time for the next report held by the rate limit */
+        n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (i=0; i<n; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &listen_tag) {
+                accept_clients();
+            } else if (ptr == &wake_tag) {
+                while (read(gpsd_wake[0], buf, sizeof(buf)) > 0)
+                    ;
+            } else {
+                struct client *c = ptr;
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    client_close(c);
+                    continue;
+                }
+                if ((events[i].events & EPOLLIN) && client_read(c) < 0)
+                    continue;
+                if (events[i].events & EPOLLOUT)
+                    client_flush(c);
+            }
+        }
+
+        pthread_mutex_lock(&gpsd_mutex);
+        running = gpsd_running;
+        pthread_mutex_unlock(&gpsd_mutex);
+        if (!running)
+            break;
+
+        timeout = dispatch_pending(now_ms());
+    }
+
+    return NULL;
+}
+
+static void close_server_fds (void)
+{
+    if (gpsd_wake[0] >= 0) {
+        close(gpsd_wake[0]);
+        close(gpsd_wake[1]);
+        gpsd_wake[0] = gpsd_wake[1] = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(gpsd_path);
+    }
+}
+
+int vogue_gpsd_start (const char *path, const char *device,
+                      int min_interval_ms)
+{
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    int rc;
+
+    if (gpsd_running)
+        return 0;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+
+    strcpy(gpsd_path, path);
+    snprintf(gpsd_device, sizeof(gpsd_device), "%s", device);
+    min_interval = min_interval_ms;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        rc = -errno;
+        perror("socket");
+        return rc;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, SOMAXCONN) < 0) {
+        rc = -errno;
+        perror("bind");
+        goto err;
+    }
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+
+    if (pipe(gpsd_wake) < 0) {
+        rc = -errno;
+        perror("pipe");
+        goto err;
+    }
+    fcntl(gpsd_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(gpsd_wake[1], F_SETFL, O_NONBLOCK);
+
+    epoll_fd = epoll_create(MAX_EVENTS);
+    if (epoll_fd < 0) {
+        rc = -errno;
+        perror("epoll_create");
+        goto err;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wake_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, gpsd_wake[0], &ev);
+
+    gpsd_running = 1;
+    rc = pthread_create(&gpsd_thread, NULL, vogue_gpsd_thread, NULL);
+    if (rc) {
+        gpsd_running = 0;
+        rc = -rc;
+        goto err;
+    }
+    return 0;
+
+err:
+    close_server_fds();
+    return rc;
+}
+
+void vogue_gpsd_stop (void)
+{
+    int i;
+
+    if (!gpsd_running)
+        return;
+
+    pthread_mutex_lock(&gpsd_mutex);
+    gpsd_running = 0;
+    pthread_mutex_unlock(&gpsd_mutex);
+    wake_io_thread();
+    pthread_join(gpsd_thread, NULL);
+
+    while (clients)
+        client_close(clients);
+    for (i=0; i<NREPORTS; i++) {
+        if (pending[i]) {
+            report_put(pending[i]);
+            pending[i] = NULL;
+        }
+    }
+    close_server_fds();
+}
+
+static void publish (int type, struct report *r)
+{
+    struct report *old;
+
+    if (!r)
+        return;
+
+    /* Only the newest report of each class matters; one the I/O thread
+     * hasn't picked up yet is simply replaced */
+    pthread_mutex_lock(&gpsd_mutex);
+    old = pending[type];
+    pending[type] = r;
+    pthread_mutex_unlock(&gpsd_mutex);
+    if (old)
+        report_put(old);
+
+    wake_io_thread();
+}
+
+void vogue_gpsd_send_location (const GpsLocation *location)
+{
+    char track[32] = "", speed[32] = "";
+
+    if (!gpsd_running || !nwatchers)
+        return;
+
+    if (location->flags & GPS_LOCATION_HAS_BEARING)
+        snprintf(track, sizeof(track), ",\"track\":%.4f", location->bearing);
+    if (location->flags & GPS_LOCATION_HAS_SPEED)
+        snprintf(speed, sizeof(speed), ",\"speed\":%.3f", location->speed);
+
+    publish(REPORT_TPV, report_new(
+        "{\"class\":\"TPV\",\"device\":\"%s\",\"mode\":2,"
+        "\"lat\":%.9f,\"lon\":%.9f,\"epx\":%.1f,\"epy\":%.1f%s%s}\r\n",
+        gpsd_device, location->latitude, location->longitude,
+        location->accuracy, location->accuracy, track, speed));
+}
+
+void vogue_gpsd_send_sv_status (const GpsSvStatus *sv_info)
+{
+    char sats[1800];
+    size_t len = 0;
+    int i;
+
+    if (!gpsd_running || !nwatchers)
+        return;
+
+    sats[0] = '\0';
+    for (i=0; i<sv_info->num_svs && i<GPS_MAX_SVS; i++) {
+        len += snprintf(sats + len, sizeof(sats) - len,
+                        "%s{\"PRN\":%d,\"ss\":%.0f,\"used\":false}",
+                        i ? "," : "", sv_info->sv_list[i].prn,
+                        sv_info->sv_list[i].snr);
+        if (len >= sizeof(sats))
+            return;
+    }
+
+    publish(REPORT_SKY, report_new(
+        "{\"class\":\"SKY\",\"device\":\"%s\",\"satellites\":[%s]}\r\n",
+        gpsd_device, sats));
+}
@@ -0,0 +1,32 @@
+#ifndef _VOGUE_GPSD_H_
+#define _VOGUE_GPSD_H_
+
+#include "gps.h"
+
+/* Minimal gpsd-compatible JSON server on a Unix domain socket.
+ *
+ * Clients get a VERSION banner on connect and TPV/SKY reports once they
+ * send ?WATCH={"enable":true};.  Each report is serialized once, however
+ * many clients are watching, and clients that fall behind lose their
+ * oldest queued reports rather than holding up everybody else. */
+
+/* Default minimum time between two reports of the same class to one
+ * client.  Reports that come in faster are coalesced, and the newest is
+ * sent once the interval is up. */
+#define GPSD_MIN_INTERVAL_MS 200
+
+/* Starts the I/O thread listening on path.  device is reported to
+ * clients as the source of the fixes.  Returns 0 or -errno. */
+int vogue_gpsd_start (const char *path, const char *device,
+                      int min_interval_ms);
+
+/* Disconnects all clients and stops the I/O thread; safe to call when the
+ * server isn't running */
+void vogue_gpsd_stop (void);
+
+/* Queue a TPV / SKY report for every watching client.  Cheap when nobody
+ * is watching. */
+void vogue_gpsd_send_location (const GpsLocation *location);
+void vogue_gpsd_send_sv_status (const GpsSvStatus *sv_info);
+
+#endif
@@ -0,0 +1,178 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include "gps.h"
+#include "vogue_gps.h"
+#include "vogue_sim.h"
+
+static pthread_t sim_thread;
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_wq = PTHREAD_COND_INITIALIZER;
+static int sim_pipe[2] = { -1, -1 };
+static int sim_enabled, sim_quit, sim_want_fix;
+static int sim_period;
+static struct gps_state sim_state;
+
+static void next_state (void)
+{
+    static unsigned step;
+    double angle;
+    int i;
+
+    /* One lap of a ~200m circle every 360 fixes */
+    angle = (step++ % 360) * M_PI / 180.0;
+    sim_state.time++;
+    sim_state.lat = (37.0 + 0.001 * sin(angle)) * 180000.0;
+    sim_state.lng = (-122.0 + 0.001 * cos(angle)) * 180000.0;
+    for (i=0; i<8; i++) {
+        sim_state.sat_state[i].sat_no = i + 1;
+        sim_state.sat_state[i].signal_strength = 25 + (step + i) % 20;
+    }
+}
+
+static void deadline (struct timespec *ts, int msec)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    ts->tv_sec = tv.tv_sec + msec / 1000;
+    ts->tv_nsec = tv.tv_usec * 1000 + (msec % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void *sim_feeder (void *arg)
+{
+    struct timespec next;
+    int rc;
+
+    (void)arg;
+
+    pthread_mutex_lock(&sim_mutex);
+    deadline(&next, 0);
+    while (!sim_quit) {
+        if (!sim_want_fix && !sim_enabled) {
+            pthread_cond_wait(&sim_wq, &sim_mutex);
+            deadline(&next, 0);
+            continue;
+        }
+        if (!sim_want_fix && sim_period) {
+            rc = pthread_cond_timedwait(&sim_wq, &sim_mutex, &next);
+            if (rc != ETIMEDOUT)
+                continue;
+        }
+
+        sim_want_fix = 0;
+        next_state();
+        /* Records are smaller than PIPE_BUF, so never split */
+        rc = write(sim_pipe[1], &sim_state, sizeof(sim_state));
+        if (rc < 0 && errno == EAGAIN) {
+            /* The reader is behind; give it a moment */
+            sim_state.time--;
+            deadline(&next, 1);
+            pthread_cond_timedwait(&sim_wq, &sim_mutex, &next);
+        }
+        deadline(&next, sim_period);
+    }
+    pthread_mutex_unlock(&sim_mutex);
+
+    return NULL;
+}
+
+int vogue_sim_open (const char *path, int flags)
+{
+    const char *period;
+    int rc;
+
+    (void)path;
+    (void)flags;
+
+    if (sim_pipe[0] >= 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (pipe(sim_pipe) < 0)
+        return -1;
+    fcntl(sim_pipe[1], F_SETFL, O_NONBLOCK);
+
+    period = getenv("VOGUE_SIM_PERIOD_MS");
+    sim_period = period ? atoi(period) : VOGUE_SIM_PERIOD_MS;
+    sim_enabled = sim_quit = sim_want_fix = 0;
+    memset(&sim_state, 0, sizeof(sim_state));
+
+    rc = pthread_create(&sim_thread, NULL, sim_feeder, NULL);
+    if (rc) {
+        close(sim_pipe[0]);
+        close(sim_pipe[1]);
+        sim_pipe[0] = sim_pipe[1] = -1;
+        errno = rc;
+        return -1;
+    }
+    return sim_pipe[0];
+}
+
+int vogue_sim_ioctl (int fd, unsigned long request, ...)
+{
+    struct gps_info *info;
+    va_list ap;
+
+    if (fd < 0 || fd != sim_pipe[0]) {
+        errno = EBADF;
+        return -1;
+    }
+
+    pthread_mutex_lock(&sim_mutex);
+    switch (request) {
+    case VGPS_IOC_ENABLE:
+        sim_enabled = 1;
+        break;
+    case VGPS_IOC_DISABLE:
+        sim_enabled = 0;
+        break;
+    case VGPS_IOC_NEW_FIX:
+        sim_want_fix = 1;
+        break;
+    case VGPS_IOC_INFO:
+        va_start(ap, request);
+        info = va_arg(ap, struct gps_info *);
+        va_end(ap);
+        info->version = GPS_VERSION;
+        info->correction_factor = 1.0;
+        break;
+    default:
+        pthread_mutex_unlock(&sim_mutex);
+        errno = ENOTTY;
+        return -1;
+    }
+    pthread_cond_broadcast(&sim_wq);
+    pthread_mutex_unlock(&sim_mutex);
+    return 0;
+}
+
+int vogue_sim_close (int fd)
+{
+    if (fd < 0 || fd != sim_pipe[0]) {
+        errno = EBADF;
+        return -1;
+    }
+
+    pthread_mutex_lock(&sim_mutex);
+    sim_quit = 1;
+    pthread_cond_broadcast(&sim_wq);
+    pthread_mutex_unlock(&sim_mutex);
+    pthread_join(sim_thread, NULL);
+
+    close(sim_pipe[0]);
+    close(sim_pipe[1]);
+    sim_pipe[0] = sim_pipe[1] = -1;
+    return 0;
+}
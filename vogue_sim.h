@@ -0,0 +1,21 @@
+#ifndef _VOGUE_SIM_H_
+#define _VOGUE_SIM_H_
+
+/* Stand-in for /dev/vogue_gps, so the HAL can run on a host.
+ *
+ * The returned fd is the read end of a pipe that a feeder thread writes
+ * struct gps_state records into while the device is enabled, driving a
+ * fix around a small circle.  The time between fixes defaults to
+ * VOGUE_SIM_PERIOD_MS and can be overridden at open time with the
+ * environment variable of the same name; 0 means as fast as the reader
+ * keeps up.  Only one device can be open at a time. */
+
+#ifndef VOGUE_SIM_PERIOD_MS
+# define VOGUE_SIM_PERIOD_MS 1000
+#endif
+
+int vogue_sim_open (const char *path, int flags);
+int vogue_sim_ioctl (int fd, unsigned long request, ...);
+int vogue_sim_close (int fd);
+
+#endif
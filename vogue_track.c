@@ -0,0 +1,177 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "vogue_track.h"
+
+/* Upper bound on worker threads; more than this just adds overhead */
+#define MAX_TRACK_THREADS 64
+
+/* Entries are handled in blocks small enough that the per-block scratch
+ * arrays stay in cache */
+#define TRACK_BLOCK 256
+
+/* Each block goes through four passes.  The coordinate conversion and
+ * speed passes are straight double-precision loops over plain arrays and
+ * vectorize (build with -O3 or -ftree-vectorize).  Pairing each fix with
+ * the last new one is inherently sequential, and the bearing pass needs
+ * atan(); both stay scalar. */
+static void process_range (const struct vogue_track_in *in,
+                           struct vogue_track_out *out,
+                           size_t start, size_t end,
+                           double correction_factor)
+{
+    const int32_t *__restrict lat = in->lat;
+    const int32_t *__restrict lng = in->lng;
+    const uint32_t *__restrict time = in->time;
+    double dlat[TRACK_BLOCK], dlng[TRACK_BLOCK], dt[TRACK_BLOCK];
+    double prev_lat = 0, prev_lng = 0;
+    uint32_t prev_time = 0;
+    int have_prev = 0;
+    size_t base, i, n;
+
+    if (start >= end)
+        return;
+
+    /* The last new fix before this range is the first entry of the run
+     * of equal times that ends at start-1.  Another thread may still be
+     * converting it, so convert it again here. */
+    if (start > 0) {
+        size_t j = start - 1;
+
+        while (j > 0 && time[j] == time[j-1])
+            j--;
+        prev_lat = vogue_track_coord(lat[j], correction_factor);
+        prev_lng = vogue_track_coord(lng[j], correction_factor);
+        prev_time = time[j];
+        have_prev = 1;
+    }
+
+    for (base=start; base<end; base+=n) {
+        double *__restrict latitude = out->latitude + base;
+        double *__restrict longitude = out->longitude + base;
+        float *__restrict speed = out->speed + base;
+        float *__restrict bearing = out->bearing + base;
+        uint16_t *__restrict flags = out->flags + base;
+
+        n = end - base;
+        if (n > TRACK_BLOCK)
+            n = TRACK_BLOCK;
+
+        for (i=0; i<n; i++) {
+            latitude[i] = vogue_track_coord(lat[base+i], correction_factor);
+            longitude[i] = vogue_track_coord(lng[base+i], correction_factor);
+        }
+
+        /* Same fix time means the kernel was only reporting signal data;
+         * anything else is measured from the last new fix */
+        for (i=0; i<n; i++) {
+            uint16_t f = 0;
+
+            if (!have_prev || time[base+i] != prev_time) {
+                f = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ACCURACY;
+                if (have_prev && prev_lat && prev_lng)
+                    f |= GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING;
+            }
+            if (f & GPS_LOCATION_HAS_SPEED) {
+                dlat[i] = latitude[i] - prev_lat;
+                dlng[i] = longitude[i] - prev_lng;
+                dt[i] = (uint32_t)(time[base+i] - prev_time);
+            } else {
+                /* Comes out as speed and bearing 0 */
+                dlat[i] = dlng[i] = 0.0;
+                dt[i] = 1.0;
+            }
+            if (f) {
+                prev_lat = latitude[i];
+                prev_lng = longitude[i];
+                prev_time = time[base+i];
+                have_prev = 1;
+            }
+            flags[i] = f;
+        }
+
+        for (i=0; i<n; i++)
+            speed[i] = vogue_track_speed(vogue_track_delta(dlat[i], dlng[i]),
+                                         dt[i]);
+
+        for (i=0; i<n; i++)
+            bearing[i] = vogue_track_bearing(dlat[i], dlng[i]);
+    }
+}
+
+void vogue_track_process (const struct vogue_track_in *in,
+                          struct vogue_track_out *out,
+                          size_t n, double correction_factor)
+{
+    process_range(in, out, 0, n, correction_factor);
+}
+
+struct track_job {
+    pthread_t thread;
+    const struct vogue_track_in *in;
+    struct vogue_track_out *out;
+    size_t start, end;
+    double correction_factor;
+};
+
+static void *track_worker (void *arg)
+{
+    struct track_job *job = arg;
+
+    process_range(job->in, job->out, job->start, job->end,
+                  job->correction_factor);
+    return NULL;
+}
+
+void vogue_track_process_mt (const struct vogue_track_in *in,
+                             struct vogue_track_out *out,
+                             size_t n, double correction_factor,
+                             int nthreads)
+{
+    struct track_job jobs[MAX_TRACK_THREADS];
+    size_t chunk;
+    int i, started, rc = 0;
+
+    if (nthreads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? cpus : 1;
+    }
+    if (nthreads > MAX_TRACK_THREADS)
+        nthreads = MAX_TRACK_THREADS;
+    /* Not worth a thread for less than a few pages of fixes each */
+    if ((size_t)nthreads > n / 4096)
+        nthreads = n / 4096;
+    if (nthreads <= 1) {
+        process_range(in, out, 0, n, correction_factor);
+        return;
+    }
+
+    chunk = (n + nthreads - 1) / nthreads;
+    for (i=0; i<nthreads; i++) {
+        jobs[i].in = in;
+        jobs[i].out = out;
+        jobs[i].start = i * chunk;
+        jobs[i].end = jobs[i].start + chunk;
+        if (jobs[i].end > n)
+            jobs[i].end = n;
+        jobs[i].correction_factor = correction_factor;
+    }
+
+    /* The calling thread takes the first chunk itself */
+    for (started=1; started<nthreads; started++) {
+        rc = pthread_create(&jobs[started].thread, NULL, track_worker,
+                            &jobs[started]);
+        if (rc)
+            break;
+    }
+    process_range(in, out, jobs[0].start, jobs[0].end, correction_factor);
+    for (i=1; i<started; i++)
+        pthread_join(jobs[i].thread, NULL);
+
+    if (rc) {
+        /* Finish whatever we couldn't hand off */
+        for (i=started; i<nthreads; i++)
+            process_range(in, out, jobs[i].start, jobs[i].end,
+                          correction_factor);
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef _VOGUE_TRACK_H_
+#define _VOGUE_TRACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include "gps.h"
+
+/* Fix math shared by the HAL (one fix at a time) and the batch track API */
+
+/* Raw kernel coordinates are 1/180000 degree, scaled by the per-device
+ * correction factor reported by VGPS_IOC_INFO */
+#define VOGUE_TRACK_SCALE 180000.0
+
+static inline double vogue_track_coord (int32_t raw, double correction_factor)
+{
+    return ((double)raw) / VOGUE_TRACK_SCALE / correction_factor;
+}
+
+/* Distance in degrees between two fixes, treating lat/lng as planar */
+static inline double vogue_track_delta (double dlat, double dlng)
+{
+    return sqrt(dlat * dlat + dlng * dlng);
+}
+
+/* Meters per second, given a delta in degrees over time_delta seconds.
+ * Everything is done in double so the batch speed pass can vectorize. */
+static inline float vogue_track_speed (double position_delta,
+                                       double time_delta)
+{
+    double speed;
+
+    /* Nautical miles per second */
+    speed = 60.0 * position_delta / time_delta;
+    /* Convert to meters per second (assuming near sea level) */
+    speed *= 1853.0;
+    return speed;
+}
+
+static inline float vogue_track_bearing (double dlat, double dlng)
+{
+    float bearing;
+
+    if (dlng != 0) {
+        bearing = fabs(dlat) / fabs(dlng);
+        bearing = atan(bearing) * 360 / (6.282);
+    } else {
+        bearing = 0.0;
+    }
+
+    if (dlat < 0) {
+        if (dlng < 0) {
+            bearing += 180.0;
+        } else {
+            bearing += 90.0;
+        }
+    } else if (dlng < 0) {
+        bearing += 270.0;
+    }
+    if (bearing >= 360.0)
+        bearing -= 360.0;
+    return bearing;
+}
+
+/* Batch API.  Input and output are structure-of-arrays.  As in the HAL,
+ * an entry repeating the previous fix time is not a new fix and gets
+ * flags of 0, and every other entry is compared against the last new fix
+ * before it.  Entry 0 (and any entry following a 0,0 position) has no
+ * speed or bearing. */
+struct vogue_track_in {
+    const int32_t *lat;
+    const int32_t *lng;
+    const uint32_t *time;
+};
+
+struct vogue_track_out {
+    double *latitude;
+    double *longitude;
+    float *speed;
+    float *bearing;
+    uint16_t *flags;        /* GPS_LOCATION_HAS_* */
+};
+
+/* Process entries [0, n) on the calling thread */
+void vogue_track_process (const struct vogue_track_in *in,
+                          struct vogue_track_out *out,
+                          size_t n, double correction_factor);
+
+/* Same, but split across nthreads (0 means one per online CPU).  If a
+ * worker can't be started its share runs on the calling thread. */
+void vogue_track_process_mt (const struct vogue_track_in *in,
+                             struct vogue_track_out *out,
+                             size_t n, double correction_factor,
+                             int nthreads);
+
+#endif